@@ -0,0 +1,169 @@
+#include "scantools.h"
+#include "treegen.h"
+#include "profiler.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QDir>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+/* peak resident set of this process in KiB, resettable on Linux 4.0 and later */
+static long peak_rss() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::stol(line.substr(6));
+    }
+    return -1;
+}
+
+static void reset_peak_rss() {
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+}
+
+static QString record(const QString &bench, int run, const QString &stage, qint64 nanoseconds,
+                      uint64_t items, uint64_t bytes, long rss) {
+    double seconds = nanoseconds / 1e9;
+    double per_second = (seconds > 0) ? 1 / seconds : 0;
+    return QString("{\"bench\":\"%1\",\"run\":%2,\"stage\":\"%3\",\"seconds\":%4,\"items\":%5,\"items_per_s\":%6,"
+                   "\"bytes\":%7,\"mb_per_s\":%8,\"peak_rss_kb\":%9}")
+            .arg(bench).arg(run).arg(stage).arg(seconds, 0, 'f', 6).arg(items).arg(items * per_second, 0, 'f', 1)
+            .arg(bytes).arg(bytes * per_second / (1024 * 1024), 0, 'f', 2).arg(rss);
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("duplicate_checker_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generates a synthetic tree, scans it and prints one JSON record per stage and run.");
+    parser.addHelpOption();
+    QCommandLineOption dir_option("dir", "Generate the tree here instead of a temporary directory.", "path");
+    QCommandLineOption existing_option("existing", "Scan this tree as it is, nothing is generated.", "path");
+    QCommandLineOption files_option("files", "Number of files.", "n", "10000");
+    QCommandLineOption depth_option("depth", "Deepest directory level.", "n", "4");
+    QCommandLineOption dir_size_option("dir-size", "Files per directory on average.", "n", "32");
+    QCommandLineOption min_size_option("min-size", "Smallest file size in bytes.", "bytes", "1024");
+    QCommandLineOption max_size_option("max-size", "Largest file size in bytes.", "bytes", "1048576");
+    QCommandLineOption duplicates_option("duplicates", "Share of duplicate files.", "ratio", "0.2");
+    QCommandLineOption same_size_option("same-size", "Share of files with a duplicated size but own content.", "ratio", "0.1");
+    QCommandLineOption hardlinks_option("hardlinks", "Share of hardlinks.", "ratio", "0.05");
+    QCommandLineOption seed_option("seed", "Seed of the generator.", "n", "1");
+    QCommandLineOption repeat_option("repeat", "Number of scans.", "n", "3");
+    QCommandLineOption algorithm_option({"a", "algorithm"}, "Hash algorithm.", "name");
+    QCommandLineOption threads_option({"j", "threads"}, "Number of hashing threads.", "n");
+    QCommandLineOption reader_option("reader", "File reads: auto, pread or uring.", "name", "auto");
+    QCommandLineOption page_cache_option("page-cache", "Page cache use of content reads: buffered, dontneed or direct.", "mode", "buffered");
+    QCommandLineOption bandwidth_option("bandwidth", "Read at most this many MiB per second.", "MiB/s");
+    QCommandLineOption collision_option({"c", "collision"}, "Compare contents of equal hashes byte by byte.");
+    QCommandLineOption cache_option("cache", "Use the persistent hash cache, runs after the first one are then warm.");
+    QCommandLineOption pipeline_option("pipeline", "Hash files of shared sizes while the walk is running.");
+    QCommandLineOption trace_option("trace", "Profile the last run, write a Chrome trace to file and a summary to stderr.", "file");
+    parser.addOptions({dir_option, existing_option, files_option, depth_option, dir_size_option, min_size_option, max_size_option,
+                       duplicates_option, same_size_option, hardlinks_option, seed_option, repeat_option,
+                       algorithm_option, threads_option, reader_option, page_cache_option, bandwidth_option,
+                       collision_option, cache_option, pipeline_option, trace_option});
+    parser.process(a);
+
+    QTextStream out(stdout), err(stderr);
+    QTemporaryDir temporary;
+    QString root;
+    if (parser.isSet(existing_option)) {
+        root = QFileInfo(parser.value(existing_option)).absoluteFilePath();
+    } else {
+        root = (parser.isSet(dir_option)) ? QFileInfo(parser.value(dir_option)).absoluteFilePath() : temporary.path() + "/tree";
+        tree_shape shape;
+        shape.files = parser.value(files_option).toULongLong();
+        shape.depth = parser.value(depth_option).toULongLong();
+        shape.dir_size = parser.value(dir_size_option).toULongLong();
+        shape.min_size = parser.value(min_size_option).toLongLong();
+        shape.max_size = parser.value(max_size_option).toLongLong();
+        shape.duplicates = parser.value(duplicates_option).toDouble();
+        shape.same_size = parser.value(same_size_option).toDouble();
+        shape.hardlinks = parser.value(hardlinks_option).toDouble();
+        shape.seed = parser.value(seed_option).toULongLong();
+        tree_stats stats;
+        std::string error;
+        QElapsedTimer timer;
+        timer.start();
+        if (!generate_tree(QFile::encodeName(root).toStdString(), shape, stats, error)) {
+            err << "cannot generate tree: " << QString::fromStdString(error) << endl;
+            return 2;
+        }
+        out << record("generate", 0, "write tree", timer.nsecsElapsed(), stats.files, stats.bytes, peak_rss()) << endl;
+        err << QString("generated %1 files in %2 directories under %3: %4 duplicates, %5 same size, %6 hardlinks")
+               .arg(stats.files).arg(stats.dirs).arg(root).arg(stats.duplicates).arg(stats.same_size).arg(stats.hardlinks) << endl;
+    }
+
+    scantools st;
+    st.set_roots(QStringList(root));
+    st.set_cache(parser.isSet(cache_option));
+    if (parser.isSet(collision_option)) st.set_mode(true);
+    st.set_pipelined(parser.isSet(pipeline_option));
+    st.set_checkpointing(0);
+    if (parser.isSet(threads_option)) st.set_hashing(parser.value(threads_option).toUInt());
+    if (parser.isSet(algorithm_option)) {
+        hash_algorithm algorithm;
+        if (!hasher::parse(parser.value(algorithm_option).toStdString(), algorithm) || !hasher::available(algorithm)) {
+            err << "unknown or unavailable algorithm " << parser.value(algorithm_option) << endl;
+            return 2;
+        }
+        st.set_algorithm(algorithm);
+    }
+    read_engine::kind reader;
+    if (!read_engine::parse(parser.value(reader_option).toStdString(), reader)) {
+        err << "unknown reader " << parser.value(reader_option) << endl;
+        return 2;
+    }
+    st.set_reader(reader);
+    io_policy policy;
+    if (!io_policy::parse(parser.value(page_cache_option).toStdString(), policy.cache)) {
+        err << "unknown page cache mode " << parser.value(page_cache_option) << endl;
+        return 2;
+    }
+    if (parser.isSet(bandwidth_option)) {
+        bool ok;
+        double bandwidth = parser.value(bandwidth_option).toDouble(&ok);
+        if (!ok || bandwidth <= 0) {
+            err << "wrong bandwidth " << parser.value(bandwidth_option) << endl;
+            return 2;
+        }
+        policy.bandwidth = static_cast<uint64_t>(bandwidth * 1024 * 1024);
+    }
+    st.set_io_policy(policy);
+    err << "hash algorithm " << hasher::name(st.get_algorithm()) << endl;
+
+    int repeat = std::max(1, parser.value(repeat_option).toInt());
+    for (int run = 1; run <= repeat; run++) {
+        if (run == repeat) st.set_profiling(parser.value(trace_option));
+        reset_peak_rss();
+        QElapsedTimer timer;
+        timer.start();
+        st.start();
+        qint64 total = timer.nsecsElapsed();
+        long rss = peak_rss();
+        if (!st.is_finished()) {
+            err << "scan did not finish" << endl;
+            return 1;
+        }
+        uint64_t files = st.get_stats(0).items, bytes = 0;
+        for (int stage = 0; stage < scantools::STAGES; stage++) {
+            const scantools::stage_stats &s = st.get_stats(stage);
+            bytes += s.bytes;
+            out << record("stage", run, scantools::stage_name(stage), s.nanoseconds, s.items, s.bytes, rss) << endl;
+        }
+        out << record("end_to_end", run, "total", total, files, bytes, rss) << endl;
+        err << QString("run %1: %2 s, %3 duplicates to delete").arg(run).arg(total / 1e9, 0, 'f', 3).arg(st.number_for_deleting()) << endl;
+    }
+    if (parser.isSet(trace_option)) err << QString::fromStdString(profiler::summary()) << flush;
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+
+checkpoint_writer::checkpoint_writer(const std::string &path) : path(path), tmp(path + ".tmp"), at(0) {
+    out = fopen(tmp.c_str(), "wb");
+    ok = out != nullptr;
+}
+
+checkpoint_writer::checkpoint_writer(const std::string &path, uint64_t offset) : path(path), at(offset) {
+    out = fopen(path.c_str(), "r+b");
+    ok = out != nullptr && fseeko(out, static_cast<off_t>(offset), SEEK_SET) == 0;
+}
+
+checkpoint_writer::~checkpoint_writer() {
+    if (out == nullptr) return;
+    fclose(out);
+    if (!tmp.empty()) unlink(tmp.c_str());
+}
+
+void checkpoint_writer::raw(const void *data, size_t size) {
+    if (ok && size > 0) ok = fwrite(data, 1, size, out) == size;
+    at += size;
+}
+
+void checkpoint_writer::put(const std::string &s) {
+    put<uint64_t>(s.size());
+    raw(s.data(), s.size());
+}
+
+bool checkpoint_writer::commit() {
+    if (out == nullptr) return false;
+    ok = fflush(out) == 0 && ok;
+    if (tmp.empty()) ok = ok && ftruncate(fileno(out), static_cast<off_t>(at)) == 0;
+    ok = fsync(fileno(out)) == 0 && ok;
+    ok = fclose(out) == 0 && ok;
+    out = nullptr;
+    if (tmp.empty()) return ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+checkpoint_reader::checkpoint_reader(const std::string &path) : left(0) {
+    in = fopen(path.c_str(), "rb");
+    struct stat st;
+    ok = in != nullptr && fstat(fileno(in), &st) == 0;
+    if (ok) left = st.st_size;
+}
+
+checkpoint_reader::checkpoint_reader(const std::string &path, uint64_t length) : checkpoint_reader(path) {
+    ok = ok && left >= length;
+    left = length;
+}
+
+checkpoint_reader::~checkpoint_reader() {
+    if (in != nullptr) fclose(in);
+}
+
+bool checkpoint_reader::raw(void *data, size_t size) {
+    if (!ok || size > left) return ok = false;
+    if (size > 0) ok = fread(data, 1, size, in) == size;
+    left -= size;
+    return ok;
+}
+
+bool checkpoint_reader::get(std::string &s) {
+    uint64_t n;
+    if (!get(n) || n > left) return ok = false;
+    s.resize(n);
+    return raw(&s[0], n);
+}
+
+bool remove_checkpoint(const std::string &path) {
+    return unlink(path.c_str()) == 0 || errno == ENOENT;
+}
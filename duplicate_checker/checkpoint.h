@@ -0,0 +1,89 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <type_traits>
+
+/* a flat binary file written under a temporary name and renamed into place on commit,
+ * so a crash leaves either the previous checkpoint or the new one, never a torn file */
+class checkpoint_writer {
+private:
+    std::string path, tmp;      // tmp is empty when the file is written in place
+    FILE *out;
+    uint64_t at;
+    bool ok;
+
+    void raw(const void *data, size_t size);
+
+public:
+    explicit checkpoint_writer(const std::string &path);
+    /* writes into the file at path from offset on and drops what followed; the first offset bytes
+     * are left as they are, so a checkpoint that refers only to them stays good */
+    checkpoint_writer(const std::string &path, uint64_t offset);
+    ~checkpoint_writer();
+
+    template <typename T>
+    void put(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are written as they are");
+        raw(&value, sizeof(T));
+    }
+    /* n values, read back as a vector */
+    template <typename T>
+    void put(const T *values, size_t n) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are written as they are");
+        put<uint64_t>(n);
+        raw(values, n * sizeof(T));
+    }
+    template <typename T>
+    void put(const std::vector<T> &values) { put(values.data(), values.size()); }
+    void put(const std::string &s);
+
+    /* bytes of the file up to the end of what was written */
+    uint64_t position() const { return at; }
+    /* flushes to disk and replaces the old checkpoint; nothing is replaced if any write failed,
+     * a file written in place is cut after the last byte written */
+    bool commit();
+};
+
+/* reads what a checkpoint_writer wrote; after the first failure every get returns false,
+ * lengths are checked against the file size, so a damaged file cannot make it allocate much */
+class checkpoint_reader {
+private:
+    FILE *in;
+    uint64_t left;
+    bool ok;
+
+    bool raw(void *data, size_t size);
+
+public:
+    explicit checkpoint_reader(const std::string &path);
+    /* reads only the first length bytes, the file has to be at least that long */
+    checkpoint_reader(const std::string &path, uint64_t length);
+    ~checkpoint_reader();
+
+    template <typename T>
+    bool get(T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are read as they are");
+        return raw(&value, sizeof(T));
+    }
+    template <typename T>
+    bool get(std::vector<T> &values) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are read as they are");
+        uint64_t n;
+        if (!get(n) || n > left / sizeof(T)) return ok = false;
+        values.resize(n);
+        return raw(values.data(), n * sizeof(T));
+    }
+    bool get(std::string &s);
+
+    bool good() const { return ok; }
+    /* true when everything was read and nothing is left over */
+    bool finished() const { return ok && left == 0; }
+};
+
+bool remove_checkpoint(const std::string &path);
+
+#endif // CHECKPOINT_H
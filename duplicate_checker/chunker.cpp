@@ -0,0 +1,154 @@
+#include "chunker.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+
+/* normalized chunking of the FastCDC paper for an 8 KiB average: 15 bits, then 11 bits, spread out */
+const uint64_t MASK_STRICT = 0x0003590703530000ULL;
+const uint64_t MASK_LOOSE = 0x0000d90003530000ULL;
+
+/* the table is fixed, so cut points never change between runs */
+struct gear_table {
+    uint64_t gear[256], shifted[256];
+
+    gear_table() {
+        uint64_t x = 0x6a09e667f3bcc908ULL;
+        for (int i = 0; i < 256; i++) {
+            /* splitmix64 */
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            gear[i] = z ^ (z >> 31);
+            shifted[i] = gear[i] << 1;
+        }
+    }
+};
+static const gear_table GEAR;
+
+/* two bytes a step: rolling the first one a bit further and testing the shifted mask gives
+ * the same cut points as one byte at a time, with half the shifts and loop tests */
+static size_t roll(const uint8_t *data, size_t size, uint64_t mask, uint64_t &fp, bool &cut) {
+    const uint64_t mask2 = mask << 1;
+    size_t i = 0;
+    for (; i + 1 < size; i += 2) {
+        fp = (fp << 2) + GEAR.shifted[data[i]];
+        if (!(fp & mask2)) {
+            cut = true;
+            return i + 1;
+        }
+        fp += GEAR.gear[data[i + 1]];
+        if (!(fp & mask)) {
+            cut = true;
+            return i + 2;
+        }
+    }
+    if (i < size) {
+        fp = (fp << 1) + GEAR.gear[data[i]];
+        if (!(fp & mask)) {
+            cut = true;
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+size_t chunker::next(const uint8_t *data, size_t size, bool &cut) {
+    cut = false;
+    size_t used = 0;
+    /* no cut is allowed before the minimum, those bytes are not even rolled */
+    if (length < MIN_SIZE) {
+        used = std::min(size, MIN_SIZE - length);
+        length += used;
+    }
+    for (auto zone : {std::make_pair(AVERAGE_SIZE, MASK_STRICT), std::make_pair(MAX_SIZE, MASK_LOOSE)}) {
+        if (used == size || length >= zone.first) continue;
+        size_t n = roll(data + used, std::min(size - used, zone.first - length), zone.second, fp, cut);
+        used += n;
+        length += n;
+        if (cut) break;
+    }
+    if (!cut && length >= MAX_SIZE) cut = true;
+    if (cut) fp = length = 0;
+    return used;
+}
+
+chunk_sink::chunk_sink(hash_algorithm algorithm) : algorithm(algorithm), part(hasher::create(algorithm)), length(0) {}
+
+void chunk_sink::add(const char *data, size_t size) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+    while (size > 0) {
+        bool cut;
+        size_t n = cuts.next(p, size, cut);
+        part->add(reinterpret_cast<const char *>(p), n);
+        length += static_cast<uint32_t>(n);
+        p += n;
+        size -= n;
+        if (cut) finish();
+    }
+}
+
+void chunk_sink::finish() {
+    digest d = part->result();
+    chunk c;
+    memcpy(&c.key, d.data(), sizeof(c.key));
+    c.length = length;
+    chunks.push_back(c);
+    part = hasher::create(algorithm);
+    length = 0;
+}
+
+digest chunk_sink::result() {
+    /* only the chunks are of use, the stream as a whole has no digest */
+    return digest();
+}
+
+std::vector<chunk_sink::chunk> chunk_sink::take() {
+    if (length > 0) finish();
+    return std::move(chunks);
+}
+
+void chunk_index::add(uint32_t file, const std::vector<chunk_sink::chunk> &chunks) {
+    std::lock_guard<std::mutex> lg(lock);
+    files++;
+    for (auto &c : chunks) entries.push_back({c.key, file, c.length});
+}
+
+void chunk_index::match(const file_table &table, double ratio, similar_files &out) {
+    out.clear();
+    out.files = files;
+    out.chunks = entries.size();
+    std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return a.key < b.key || (a.key == b.key && a.file < b.file);
+    });
+    /* a chunk counts once per pair of files holding it, however often they repeat it */
+    std::unordered_map<uint64_t, uint64_t> shared;
+    std::vector<uint32_t> holders;
+    for (size_t b = 0, e; b < entries.size(); b = e) {
+        e = b + 1;
+        while (e < entries.size() && entries[e].key == entries[b].key) e++;
+        uint64_t length = entries[b].length;
+        out.bytes += length * (e - b);
+        out.unique += length;
+        holders.clear();
+        for (size_t k = b; k < e; k++) {
+            if (holders.empty() || holders.back() != entries[k].file) holders.push_back(entries[k].file);
+        }
+        if (holders.size() < 2 || holders.size() > POSTING_LIMIT) continue;
+        for (size_t i = 0; i < holders.size(); i++) {
+            for (size_t j = i + 1; j < holders.size(); j++) {
+                shared[(static_cast<uint64_t>(holders[i]) << 32) | holders[j]] += length;
+            }
+        }
+    }
+    for (auto &s : shared) {
+        uint32_t a = static_cast<uint32_t>(s.first >> 32), b = static_cast<uint32_t>(s.first);
+        int64_t smaller = std::min(table.size[a], table.size[b]);
+        if (smaller > 0 && s.second >= ratio * smaller) out.pairs.push_back({a, b, s.second});
+    }
+    std::sort(out.pairs.begin(), out.pairs.end(), [](const similar_files::pair &x, const similar_files::pair &y) {
+        return x.shared > y.shared || (x.shared == y.shared && (x.a < y.a || (x.a == y.a && x.b < y.b)));
+    });
+    entries.clear();
+    entries.shrink_to_fit();
+}
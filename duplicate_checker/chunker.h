@@ -0,0 +1,100 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include "hasher.h"
+#include "filetable.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+/* a stream cut into chunks at content-defined points: FastCDC with a Gear rolling hash,
+ * a strict mask below the average size and a loose one above it; an insertion moves only
+ * the cut points next to it, so files sharing most of their content share most chunks */
+class chunker {
+public:
+    static const size_t MIN_SIZE = 2 * 1024;
+    static const size_t AVERAGE_SIZE = 8 * 1024;
+    static const size_t MAX_SIZE = 64 * 1024;
+
+private:
+    uint64_t fp;
+    size_t length;              // of the chunk so far
+
+public:
+    chunker() : fp(0), length(0) {}
+
+    /* bytes of data up to and including the next cut point, or all of them without one */
+    size_t next(const uint8_t *data, size_t size, bool &cut);
+};
+
+/* takes the place of a hasher in a read job: the data is chunked and each chunk digested on
+ * its own, so any read engine can feed it */
+class chunk_sink : public hasher {
+public:
+    struct chunk {
+        uint64_t key;           // leading bytes of the chunk digest
+        uint32_t length;
+    };
+
+private:
+    hash_algorithm algorithm;
+    chunker cuts;
+    std::unique_ptr<hasher> part;
+    uint32_t length;
+    std::vector<chunk> chunks;
+
+    void finish();
+
+public:
+    explicit chunk_sink(hash_algorithm algorithm);
+
+    void add(const char *data, size_t size) override;
+    digest result() override;
+    /* chunks of the whole stream in order, the last one included */
+    std::vector<chunk> take();
+};
+
+/* files that share much of their content chunk by chunk, beyond exact duplicates */
+struct similar_files {
+    struct pair {
+        uint32_t a, b;          // file ids
+        uint64_t shared;        // bytes of distinct chunks found in both
+    };
+
+    std::vector<pair> pairs;    // largest shares first
+    uint64_t files = 0, chunks = 0;
+    uint64_t bytes = 0;         // in all chunks
+    uint64_t unique = 0;        // in distinct chunks, the rest could be stored once
+
+    uint64_t deduplicable() const { return bytes - unique; }
+    void clear() { *this = similar_files(); }
+};
+
+/* chunks of many files in memory; keys are sorted once all files are in, chunks found
+ * in more files than POSTING_LIMIT (runs of zeros and the like) count for the totals only */
+class chunk_index {
+private:
+    struct entry {
+        uint64_t key;
+        uint32_t file, length;
+    };
+
+    std::mutex lock;
+    std::vector<entry> entries;
+    uint64_t files;
+
+public:
+    static const size_t POSTING_LIMIT = 64;
+
+    chunk_index() : files(0) {}
+
+    /* safe to call from the threads of a read engine */
+    void add(uint32_t file, const std::vector<chunk_sink::chunk> &chunks);
+    /* pairs whose shared bytes are at least ratio of the smaller file */
+    void match(const file_table &table, double ratio, similar_files &out);
+    size_t memory() const { return entries.capacity() * sizeof(entry); }
+};
+
+#endif // CHUNKER_H
@@ -0,0 +1,385 @@
+#include "scantools.h"
+#include "profiler.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDir>
+
+#include <cstdio>
+#include <csignal>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+
+const std::chrono::milliseconds PROGRESS_PERIOD(100);
+
+static scantools *running = nullptr;
+static bool resumable = true;
+static std::atomic<bool> watching(false);
+
+static void interrupt_handler(int) {
+    /* pause and cancel only store atomic flags, so they are fine in a signal handler;
+     * a paused scan leaves a checkpoint to resume from */
+    if (watching) {
+        watching = false;
+        return;
+    }
+    if (running == nullptr) return;
+    if (resumable && running->is_scanning()) {
+        running->pause();
+    } else {
+        running->cancel();
+    }
+}
+
+static QString json_string(const QString &s) {
+    QString out = "\"";
+    for (QChar c : s) {
+        if (c == '"') {
+            out += "\\\"";
+        } else if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c.unicode() < 0x20) {
+            out += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+/* a number of bytes, with an optional K, M, G or T suffix for powers of 1024 */
+static bool parse_size(const QString &s, qint64 &size) {
+    QString digits = s;
+    qint64 unit = 1;
+    if (!s.isEmpty()) {
+        int k = QString("KMGT").indexOf(s.right(1).toUpper());
+        if (k >= 0) {
+            digits.chop(1);
+            unit = qint64(1) << (10 * (k + 1));
+        }
+    }
+    bool ok;
+    size = digits.toLongLong(&ok) * unit;
+    return ok && size >= 0;
+}
+
+static QString csv_field(const QString &s) {
+    if (!s.contains(',') && !s.contains('"') && !s.contains('\n')) return s;
+    return "\"" + QString(s).replace("\"", "\"\"") + "\"";
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("duplicate_checker_cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Finds duplicate files and streams the groups to stdout.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("roots", "Directories to scan, the current one by default.", "[roots...]");
+    QCommandLineOption algorithm_option({"a", "algorithm"}, "Hash algorithm: md5, sha256, xxh3 or blake3.", "name");
+    QCommandLineOption threads_option({"j", "threads"}, "Number of hashing threads.", "n");
+    QCommandLineOption reader_option("reader", "File reads: auto, pread or uring.", "name", "auto");
+    QCommandLineOption page_cache_option("page-cache", "Page cache use of content reads: buffered, dontneed or direct.", "mode", "buffered");
+    QCommandLineOption bandwidth_option("bandwidth", "Read at most this many MiB per second.", "MiB/s");
+    QCommandLineOption format_option({"f", "format"}, "Output format: ndjson or csv.", "format", "ndjson");
+    QCommandLineOption collision_option({"c", "collision"}, "Compare contents of equal hashes byte by byte.");
+    QCommandLineOption no_cache_option("no-cache", "Do not use the persistent hash cache.");
+    QCommandLineOption verbose_option({"v", "verbose"}, "Print progress to stderr.");
+    QCommandLineOption pipeline_option({"p", "pipeline"}, "Start hashing files of shared sizes while directories are still walked.");
+    QCommandLineOption trace_option("trace", "Profile the scan, write a Chrome trace to file and a summary to stderr.", "file");
+    QCommandLineOption resume_option("resume", "Resume the scan an interrupted run left, its roots are used.");
+    QCommandLineOption no_checkpoint_option("no-checkpoint", "Do not save the scan state, an interrupted scan is then lost.");
+    QCommandLineOption device_threads_option("device-threads", "Read files of the device path is on with at most n threads, 0 for no limit; can be repeated.", "path=n");
+    QCommandLineOption no_scheduling_option("no-device-scheduling", "Read every device with all threads instead of limiting spinning disks and network shares.");
+    QCommandLineOption min_size_option("min-size", "Leave out files smaller than this, e.g. 1 or 4K.", "bytes");
+    QCommandLineOption max_size_option("max-size", "Leave out files larger than this, e.g. 2G.", "bytes");
+    QCommandLineOption include_option("include", "Only take files matching the glob, matched against the name or, with a slash in it, the whole path; \"**\" crosses directories. Can be repeated.", "glob");
+    QCommandLineOption exclude_option("exclude", "Leave out files and directories matching the glob, excluded directories are not entered. Can be repeated.", "glob");
+    QCommandLineOption exclude_regex_option("exclude-regex", "Leave out files and directories whose whole path matches the regular expression. Can be repeated.", "regex");
+    QCommandLineOption hidden_option("hidden", "Take hidden files and directories too.");
+    QCommandLineOption one_file_system_option({"x", "one-file-system"}, "Do not enter file systems mounted below the roots.");
+    QCommandLineOption trees_option("trees", "Report directories copied as a whole once, as a group of kind directory, instead of a group per file in them; groups are then printed when the scan is over.");
+    QCommandLineOption similar_option("similar", "Also cut files into content-defined chunks and report pairs sharing at least this part of the smaller file, e.g. 0.5, as groups of kind similar whose size is the bytes shared.", "ratio");
+    QCommandLineOption memory_budget_option("memory-budget", "Keep file records within about this much memory, e.g. 2G: beyond it the walk is spilled to TMPDIR and only files of shared sizes are read back, in batches; directory trees and similar files are then not looked for and changes are not watched.", "bytes");
+    QCommandLineOption reclaim_option("reclaim", "After the scan, delete every duplicate but the first copy of its group, or replace it with a hardlink or a reflink to it: delete, hardlink or reflink.", "action");
+    QCommandLineOption watch_option({"w", "watch"}, "After the scan, watch the roots and print all groups again whenever they change, until interrupted.");
+    parser.addOptions({algorithm_option, threads_option, reader_option, page_cache_option, bandwidth_option, format_option, collision_option, no_cache_option, verbose_option, pipeline_option, trace_option,
+                       resume_option, no_checkpoint_option, device_threads_option, no_scheduling_option,
+                       min_size_option, max_size_option, include_option, exclude_option, exclude_regex_option, hidden_option, one_file_system_option, trees_option, similar_option, memory_budget_option, reclaim_option, watch_option});
+    parser.process(a);
+
+    QTextStream out(stdout), err(stderr);
+    scantools st;
+    if (parser.isSet(algorithm_option)) {
+        hash_algorithm algorithm;
+        if (!hasher::parse(parser.value(algorithm_option).toStdString(), algorithm) || !hasher::available(algorithm)) {
+            err << "unknown or unavailable algorithm " << parser.value(algorithm_option) << endl;
+            return 2;
+        }
+        st.set_algorithm(algorithm);
+    }
+    if (parser.isSet(threads_option)) {
+        bool ok;
+        uint threads = parser.value(threads_option).toUInt(&ok);
+        if (!ok || threads == 0) {
+            err << "wrong number of threads " << parser.value(threads_option) << endl;
+            return 2;
+        }
+        st.set_hashing(threads);
+    }
+    read_engine::kind reader;
+    if (!read_engine::parse(parser.value(reader_option).toStdString(), reader)) {
+        err << "unknown reader " << parser.value(reader_option) << endl;
+        return 2;
+    }
+    st.set_reader(reader);
+    io_policy policy;
+    if (!io_policy::parse(parser.value(page_cache_option).toStdString(), policy.cache)) {
+        err << "unknown page cache mode " << parser.value(page_cache_option) << endl;
+        return 2;
+    }
+    if (parser.isSet(bandwidth_option)) {
+        bool ok;
+        double bandwidth = parser.value(bandwidth_option).toDouble(&ok);
+        if (!ok || bandwidth <= 0) {
+            err << "wrong bandwidth " << parser.value(bandwidth_option) << endl;
+            return 2;
+        }
+        policy.bandwidth = static_cast<uint64_t>(bandwidth * 1024 * 1024);
+    }
+    st.set_io_policy(policy);
+    st.set_scheduling(!parser.isSet(no_scheduling_option));
+    for (const QString &value : parser.values(device_threads_option)) {
+        int at = value.lastIndexOf('=');
+        bool ok = at > 0;
+        uint limit = (ok) ? value.mid(at + 1).toUInt(&ok) : 0;
+        if (!ok || !st.set_device_limit(value.left(at), limit)) {
+            err << "wrong device limit " << value << endl;
+            return 2;
+        }
+    }
+    walk_filter filter;
+    qint64 min_size = 0, max_size = -1;
+    if (parser.isSet(min_size_option) && !parse_size(parser.value(min_size_option), min_size)) {
+        err << "wrong size " << parser.value(min_size_option) << endl;
+        return 2;
+    }
+    if (parser.isSet(max_size_option) && !parse_size(parser.value(max_size_option), max_size)) {
+        err << "wrong size " << parser.value(max_size_option) << endl;
+        return 2;
+    }
+    filter.min_size = min_size;
+    filter.max_size = max_size;
+    for (const QString &glob : parser.values(include_option)) {
+        if (!filter.include.add_glob(QFile::encodeName(glob).toStdString())) {
+            err << "wrong pattern " << glob << endl;
+            return 2;
+        }
+    }
+    for (const QString &glob : parser.values(exclude_option)) {
+        if (!filter.exclude.add_glob(QFile::encodeName(glob).toStdString())) {
+            err << "wrong pattern " << glob << endl;
+            return 2;
+        }
+    }
+    for (const QString &regex : parser.values(exclude_regex_option)) {
+        if (!filter.exclude.add_regex(QFile::encodeName(regex).toStdString())) {
+            err << "wrong regular expression " << regex << endl;
+            return 2;
+        }
+    }
+    filter.hidden = parser.isSet(hidden_option);
+    filter.one_device = parser.isSet(one_file_system_option);
+    st.set_filter(filter);
+    QString format = parser.value(format_option);
+    if (format != "ndjson" && format != "csv") {
+        err << "unknown format " << format << endl;
+        return 2;
+    }
+    bool csv = format == "csv";
+    if (parser.isSet(similar_option)) {
+        bool ok;
+        double ratio = parser.value(similar_option).toDouble(&ok);
+        if (!ok || ratio <= 0 || ratio > 1) {
+            err << "wrong similarity ratio " << parser.value(similar_option) << endl;
+            return 2;
+        }
+        st.set_similar(ratio);
+    }
+    if (parser.isSet(memory_budget_option)) {
+        qint64 budget;
+        if (!parse_size(parser.value(memory_budget_option), budget) || budget == 0) {
+            err << "wrong memory budget " << parser.value(memory_budget_option) << endl;
+            return 2;
+        }
+        st.set_memory_budget(static_cast<size_t>(budget));
+    }
+    reclaimer::action act = reclaimer::DELETE;
+    if (parser.isSet(reclaim_option) && !reclaimer::parse(parser.value(reclaim_option).toStdString(), act)) {
+        err << "unknown reclaim action " << parser.value(reclaim_option) << endl;
+        return 2;
+    }
+
+    QStringList roots;
+    for (const QString &r : parser.positionalArguments()) {
+        QFileInfo info(r);
+        if (!info.isDir() || !info.isReadable()) {
+            err << "cannot open " << r << endl;
+            return 2;
+        }
+        QString root = info.canonicalFilePath();
+        if (!roots.contains(root)) roots << root;
+    }
+    if (roots.isEmpty()) roots << QDir::currentPath();
+    st.set_roots(roots);
+    if (parser.isSet(collision_option)) st.set_mode(true);
+    st.set_cache(!parser.isSet(no_cache_option));
+    bool trees = parser.isSet(trees_option);
+    st.set_trees(trees);
+    st.set_streaming(!trees);
+    st.set_pipelined(parser.isSet(pipeline_option));
+    st.set_profiling(parser.value(trace_option));
+    st.set_watching(parser.isSet(watch_option));
+    resumable = !parser.isSet(no_checkpoint_option);
+    if (!resumable) st.set_checkpointing(0);
+    if (parser.isSet(resume_option)) {
+        if (!st.has_checkpoint()) {
+            err << "no interrupted scan to resume" << endl;
+            return 2;
+        }
+        if (!st.resume_checkpoint()) {
+            err << "cannot resume the interrupted scan, its checkpoint is damaged" << endl;
+            return 2;
+        }
+    }
+
+    /* the scan runs in a worker thread and calls these lambdas directly,
+     * this thread only samples the progress counters */
+    bool verbose = parser.isSet(verbose_option);
+    std::mutex err_lock;
+    QObject::connect(&st, &scantools::console, [&err, &err_lock, verbose](QString text, bool save, QString) {
+        std::lock_guard<std::mutex> lg(err_lock);
+        if (verbose && !text.isEmpty()) err << text << ((save) ? "\n" : "\r") << flush;
+    });
+    size_t group = 0;
+    std::mutex out_lock;
+    if (csv) out << "group,kind,size,hash,path" << endl;
+    auto print_group = [&](const QString &kind, qint64 size, const QString &hash, const QStringList &paths) {
+        group++;
+        if (csv) {
+            for (const QString &p : paths) {
+                out << group << ',' << kind << ',' << size << ',' << hash << ',' << csv_field(p) << '\n';
+            }
+        } else {
+            out << "{\"group\":" << group << ",\"kind\":\"" << kind << "\",\"size\":" << size << ",\"hash\":\"" << hash << "\",\"paths\":[";
+            for (int k = 0; k < paths.size(); k++) {
+                out << ((k == 0) ? "" : ",") << json_string(paths[k]);
+            }
+            out << "]}\n";
+        }
+    };
+    QObject::connect(&st, &scantools::group_found, [&](QString kind, qint64 size, QString hash, QStringList paths) {
+        std::lock_guard<std::mutex> lg(out_lock);
+        print_group(kind, size, hash, paths);
+        out.flush();
+    });
+    auto print_result = [&](const scan_result &r) {
+        const file_table &t = r.files;
+        for (size_t k = 0; k < r.trees.trees.size(); k++) {
+            QStringList paths;
+            for (uint32_t d : r.trees.trees[k]) paths << QFile::decodeName(t.dir_path(d).c_str());
+            print_group("directory", static_cast<qint64>(r.trees.bytes[k]), QString::fromStdString(to_hex(r.trees.hash[k])), paths);
+        }
+        size_t n = 0;
+        for (auto *groups : {&r.duplicates, &r.hardlinks}) {
+            bool links = groups == &r.hardlinks;
+            for (auto &g : *groups) {
+                if (r.trees.is_collapsed(n++)) continue;
+                QStringList paths;
+                for (uint32_t f : g) paths << QFile::decodeName(t.path(f).c_str());
+                print_group((links) ? "hardlink" : "duplicate", t.size[g[0]], (links) ? "" : QString::fromStdString(to_hex(t.hash[g[0]])), paths);
+            }
+        }
+    };
+    /* without streaming the groups are known only once the scan is over, similar files always are */
+    similar_files similar;
+    QObject::connect(&st, &scantools::results_ready, [&](std::shared_ptr<const scan_result> r) {
+        std::lock_guard<std::mutex> lg(out_lock);
+        similar = r->similar;
+        if (trees) print_result(*r);
+        for (auto &p : r->similar.pairs) {
+            print_group("similar", static_cast<qint64>(p.shared), "", QStringList() << QFile::decodeName(r->files.path(p.a).c_str())
+                        << QFile::decodeName(r->files.path(p.b).c_str()));
+        }
+        out.flush();
+    });
+    /* every change is announced by an update line, then all groups as they are now follow */
+    size_t update = 0;
+    QObject::connect(&st, &scantools::results_changed, [&](std::shared_ptr<const scan_result> r) {
+        std::lock_guard<std::mutex> lg(out_lock);
+        update++;
+        if (csv) {
+            out << 0 << ",update," << update << ",," << '\n';
+        } else {
+            out << "{\"update\":" << update << ",\"duplicates\":" << r->duplicates.size() << ",\"hardlinks\":" << r->hardlinks.size() << "}\n";
+        }
+        print_result(*r);
+        out.flush();
+    });
+    running = &st;
+    signal(SIGINT, interrupt_handler);
+    signal(SIGTERM, interrupt_handler);
+    std::atomic<bool> done(false);
+    std::thread worker([&st, &done]() {
+        st.start();
+        done = true;
+    });
+    while (!done) {
+        std::this_thread::sleep_for(PROGRESS_PERIOD);
+        std::lock_guard<std::mutex> lg(err_lock);
+        if (verbose && st.is_scanning()) err << st.progress_text() << "\r" << flush;
+    }
+    worker.join();
+    running = nullptr;
+    if (verbose) err << endl;
+    if (parser.isSet(trace_option)) err << QString::fromStdString(profiler::summary()) << flush;
+    if (st.is_paused()) err << "scan interrupted, continue it with --resume" << endl;
+    if (!st.is_finished()) return 1;
+    if (parser.isSet(similar_option)) {
+        err << QString("%1 files in %2 chunks, %3 bytes could be stored once at chunk level")
+               .arg(similar.files).arg(similar.chunks).arg(similar.deduplicable()) << endl;
+    }
+    if (parser.isSet(reclaim_option)) {
+        auto result = st.current_result();
+        std::vector<std::pair<uint32_t, uint32_t>> plan;
+        for (auto &g : result->duplicates) {
+            for (uint32_t f : g) {
+                /* kept copies of directories stay whole, the first file of a group lies outside the copies */
+                if (result->trees.copy_at(result->files.dir[f]) != tree_groups::KEPT) plan.push_back(std::make_pair(f, g[0]));
+            }
+        }
+        /* an interrupt cancels the rest, files already handled stay so */
+        running = &st;
+        reclaimer::report rep = st.reclaim(*result, plan, act);
+        running = nullptr;
+        err << QString("%1: %2 done, %3 changed since the scan, %4 failed, %5 left when interrupted, %6 bytes freed")
+               .arg(reclaimer::name(act)).arg(rep.done).arg(rep.changed).arg(rep.failed).arg(rep.left).arg(rep.bytes) << endl;
+        for (auto &e : rep.errors) err << QString::fromStdString(e) << endl;
+        if (rep.failed > 0 || rep.left > 0) return 1;
+    }
+    if (st.is_watching()) {
+        if (verbose) err << "watching for changes, interrupt to stop" << endl;
+        watching = true;
+        while (watching) std::this_thread::sleep_for(PROGRESS_PERIOD);
+        st.stop_watching();
+    }
+    return 0;
+}
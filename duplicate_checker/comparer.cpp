@@ -0,0 +1,176 @@
+#include "comparer.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t MAX_OPEN = 256;
+const size_t MIN_BLOCK = 64 * 1024;
+const size_t MAX_BLOCK = 4 * 1024 * 1024;
+const size_t ALIGNMENT = 4096;
+
+/* blocks start at aligned offsets, with O_DIRECT the last one is read up to an aligned length */
+static bool read_block(int fd, bool direct, char *buffer, size_t length, long long offset, uint64_t &calls,
+                       io_governor *governor) {
+    io_governor::window window;
+    size_t want = (direct) ? io_governor::align_up(length) : length;
+    if (governor != nullptr) governor->before(fd, direct, offset, want, window);
+    size_t got = 0;
+    while (got < length) {
+        ssize_t n = pread(fd, buffer + got, want - got, offset + got);
+        calls++;
+        if (n <= 0) break;
+        got += n;
+    }
+    if (governor != nullptr) governor->after(fd, direct, offset, got, window);
+    return got >= length;
+}
+
+content_comparer::content_comparer(size_t budget) : budget(budget), bytes(0), governor(nullptr) {}
+
+uint64_t content_comparer::take_bytes() {
+    uint64_t b = bytes;
+    bytes = 0;
+    return b;
+}
+
+bool content_comparer::split(const std::vector<std::string> &paths, long long size,
+                             std::vector<std::vector<size_t>> &classes, std::vector<size_t> &failed,
+                             const std::function<bool()> &interrupted) {
+    classes.clear();
+    failed.clear();
+    std::vector<size_t> members(paths.size());
+    for (size_t i = 0; i < members.size(); i++) members[i] = i;
+    if (members.size() <= MAX_OPEN) return split_open(paths, members, size, classes, failed, interrupted);
+
+    /* too many files to keep open: they are read in windows, each along with one file of every class
+     * found before it, and join the class of the file they match; a file is read once per window,
+     * unless the classes so far are too many to open at once */
+    const size_t REPS = MAX_OPEN / 2;
+    std::map<size_t, size_t> class_of;  // by the file standing for it
+    for (size_t at = 0; at < members.size();) {
+        size_t known = classes.size();
+        size_t room = MAX_OPEN - std::min(known, REPS);
+        std::vector<size_t> window(members.begin() + at, members.begin() + std::min(members.size(), at + room));
+        at += window.size();
+        for (size_t c0 = 0;; c0 += REPS) {
+            size_t c1 = std::min(known, c0 + REPS);
+            std::vector<size_t> chunk;
+            for (size_t c = c0; c < c1; c++) chunk.push_back(classes[c][0]);
+            chunk.insert(chunk.end(), window.begin(), window.end());
+            std::vector<std::vector<size_t>> parts;
+            std::vector<size_t> part_failed;
+            if (!split_open(paths, chunk, size, parts, part_failed, interrupted)) return false;
+            /* a class whose file cannot be read again just takes no one from this window */
+            for (size_t f : part_failed) {
+                if (!class_of.count(f)) failed.push_back(f);
+            }
+            window.clear();
+            std::vector<std::vector<size_t>> unmatched;
+            for (auto &part : parts) {
+                auto rep = std::find_if(part.begin(), part.end(), [&class_of](size_t f) { return class_of.count(f) > 0; });
+                if (rep == part.end()) {
+                    window.insert(window.end(), part.begin(), part.end());
+                    unmatched.push_back(std::move(part));
+                    continue;
+                }
+                auto &c = classes[class_of[*rep]];
+                for (size_t f : part) {
+                    if (!class_of.count(f)) c.push_back(f);
+                }
+            }
+            if (c1 < known && !window.empty()) continue;
+            for (auto &part : unmatched) {
+                class_of[part[0]] = classes.size();
+                classes.push_back(std::move(part));
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+bool content_comparer::split_open(const std::vector<std::string> &paths, const std::vector<size_t> &members, long long size,
+                                  std::vector<std::vector<size_t>> &classes, std::vector<size_t> &failed,
+                                  const std::function<bool()> &interrupted) {
+    std::vector<int> fds;
+    std::vector<bool> direct;
+    std::vector<size_t> opened;
+    uint64_t calls = 0, loaded = 0;
+    for (size_t m : members) {
+        bool d = false;
+        int fd = (governor != nullptr) ? governor->open(paths[m], d) : open(paths[m].c_str(), O_RDONLY | O_CLOEXEC);
+        calls++;
+        if (fd < 0) {
+            failed.push_back(m);
+            continue;
+        }
+        if (governor == nullptr || governor->get_policy().cache == io_policy::BUFFERED) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        calls += 2; // fadvise now, close later
+        fds.push_back(fd);
+        direct.push_back(d);
+        opened.push_back(m);
+    }
+    size_t n = fds.size();
+    size_t block = std::max(MIN_BLOCK, std::min(MAX_BLOCK, budget / std::max<size_t>(n, 1)));
+    block = (block + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    char *buffers = static_cast<char *>(aligned_alloc(ALIGNMENT, block * std::max<size_t>(n, 1)));
+
+    /* classes of positions in fds; a class of one is final */
+    std::vector<std::vector<size_t>> alive(1), next;
+    for (size_t k = 0; k < n; k++) alive[0].push_back(k);
+    bool complete = true;
+    for (long long offset = 0; offset < size && !alive.empty(); offset += block) {
+        if (interrupted()) {
+            complete = false;
+            break;
+        }
+        size_t length = static_cast<size_t>(std::min<long long>(block, size - offset));
+        next.clear();
+        for (auto &c : alive) {
+            size_t first = next.size();
+            for (size_t k : c) {
+                char *buffer = buffers + k * block;
+                if (!read_block(fds[k], direct[k], buffer, length, offset, calls, governor)) {
+                    failed.push_back(opened[k]);
+                    continue;
+                }
+                loaded += length;
+                size_t s = first;
+                while (s < next.size() && memcmp(buffers + next[s][0] * block, buffer, length) != 0) s++;
+                if (s == next.size()) next.emplace_back();
+                next[s].push_back(k);
+            }
+        }
+        alive.clear();
+        for (auto &c : next) {
+            if (c.size() > 1) {
+                alive.push_back(std::move(c));
+            } else if (c.size() == 1) {
+                classes.push_back({opened[c[0]]});
+                close(fds[c[0]]);
+                fds[c[0]] = -1;
+            }
+        }
+    }
+    if (complete) {
+        for (auto &c : alive) {
+            if (c.empty()) continue;
+            classes.emplace_back();
+            for (size_t k : c) classes.back().push_back(opened[k]);
+        }
+    }
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+    free(buffers);
+    bytes += loaded;
+    if (profiler::enabled()) profiler::count(calls, loaded);
+    return complete;
+}
@@ -0,0 +1,38 @@
+#ifndef COMPARER_H
+#define COMPARER_H
+
+#include "iopolicy.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+/* splits files of one size into classes of identical content: all members of a group
+ * are opened once and read block by block in lockstep, a class is divided as soon as
+ * its members differ and files left alone in their class are not read any further;
+ * a group too big to keep open is read in windows against a file of each class so far */
+class content_comparer {
+private:
+    size_t budget;
+    uint64_t bytes;
+    io_governor *governor;
+
+    bool split_open(const std::vector<std::string> &paths, const std::vector<size_t> &members, long long size,
+                    std::vector<std::vector<size_t>> &classes, std::vector<size_t> &failed,
+                    const std::function<bool()> &interrupted);
+
+public:
+    explicit content_comparer(size_t budget = 64 * 1024 * 1024);
+
+    /* classes and failed hold indices into paths; false if interrupted() stopped the comparison */
+    bool split(const std::vector<std::string> &paths, long long size,
+               std::vector<std::vector<size_t>> &classes, std::vector<size_t> &failed,
+               const std::function<bool()> &interrupted);
+    /* files are then opened and read as the governor says */
+    void set_governor(io_governor *governor) { this->governor = governor; }
+    /* bytes read since the last call */
+    uint64_t take_bytes();
+};
+
+#endif // COMPARER_H
@@ -0,0 +1,129 @@
+#include "devices.h"
+
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/sysmacros.h>
+
+const size_t ROTATIONAL_LIMIT = 1;      // one reader keeps a disk streaming instead of seeking
+const size_t NETWORK_LIMIT = 4;         // enough requests in flight to hide the round trips
+
+/* f_type of file systems served over the network or from user space */
+const long NETWORK_TYPES[] = {0x6969 /* nfs */, 0x517B /* smb */, static_cast<long>(0xFF534D42) /* cifs */,
+                              static_cast<long>(0xFE534D42) /* smb2 */, 0x65735546 /* fuse */,
+                              0x564C /* ncp */, 0x73757245 /* coda */, 0x6B414653 /* afs */};
+
+device_limits::device_limits() : rotational(ROTATIONAL_LIMIT), network(NETWORK_LIMIT) {}
+
+bool device_limits::set(const std::string &path, size_t limit) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    std::lock_guard<std::mutex> lg(lock);
+    devices[st.st_dev] = {probe(st.st_dev, path), limit, true};
+    return true;
+}
+
+size_t device_limits::get(uint64_t dev, const std::string &path) const {
+    std::lock_guard<std::mutex> lg(lock);
+    auto d = devices.find(dev);
+    if (d != devices.end()) return d->second.limit;
+    kind k = probe(dev, path);
+    size_t limit = (k == ROTATIONAL) ? rotational : (k == NETWORK) ? network : UNLIMITED;
+    devices[dev] = {k, limit, false};
+    return limit;
+}
+
+std::map<uint64_t, device_limits::device> device_limits::known() const {
+    std::lock_guard<std::mutex> lg(lock);
+    return devices;
+}
+
+void device_limits::forget() {
+    /* guesses are made again for the next scan, given limits stay */
+    std::lock_guard<std::mutex> lg(lock);
+    for (auto d = devices.begin(); d != devices.end();) {
+        d = (d->second.set) ? std::next(d) : devices.erase(d);
+    }
+}
+
+device_limits::kind device_limits::probe(uint64_t dev, const std::string &path) {
+    struct statfs fs;
+    if (statfs(path.c_str(), &fs) == 0) {
+        for (long t : NETWORK_TYPES) {
+            if (static_cast<long>(fs.f_type) == t) return NETWORK;
+        }
+    }
+    /* a partition has no queue of its own, the one of its disk is a level up */
+    std::string base = "/sys/dev/block/" + name(dev);
+    for (const char *queue : {"/queue/rotational", "/../queue/rotational"}) {
+        std::ifstream in(base + queue);
+        int rotational;
+        if (in >> rotational) return (rotational != 0) ? ROTATIONAL : SOLID;
+    }
+    return SOLID;
+}
+
+const char *device_limits::name(kind k) {
+    switch (k) {
+        case ROTATIONAL: return "rotational";
+        case NETWORK: return "network";
+        default: return "solid";
+    }
+}
+
+std::string device_limits::name(uint64_t dev) {
+    return std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+}
+
+device_scheduler::device_scheduler(kind reader, size_t threads, size_t depth, const device_limits &limits,
+                                   io_governor &governor, std::atomic<uint64_t> *bytes)
+    : reader(reader), limits(limits), governor(governor), bytes(bytes) {
+    shared = read_engine::create(reader, threads, depth, governor, bytes);
+    label = std::string(shared->name()) + " per device";
+}
+
+read_engine &device_scheduler::engine_for(const read_job &job) {
+    size_t limit = limits.get(job.dev, job.path);
+    if (limit == device_limits::UNLIMITED) return *shared;
+    std::lock_guard<std::mutex> lg(lock);
+    auto &e = engines[job.dev];
+    /* a thread per file read at once, io_uring ones then keep one file in flight each */
+    if (!e) e = read_engine::create(reader, limit, 2 * limit, governor, bytes, 1);
+    return *e;
+}
+
+bool device_scheduler::push(read_job &&job, std::chrono::milliseconds timeout) {
+    return engine_for(job).push(std::move(job), timeout);
+}
+
+std::vector<read_engine *> device_scheduler::all() {
+    /* engines are never dropped before the scheduler, so they are used outside the lock */
+    std::vector<read_engine *> list(1, shared.get());
+    std::lock_guard<std::mutex> lg(lock);
+    for (auto &e : engines) list.push_back(e.second.get());
+    return list;
+}
+
+bool device_scheduler::wait(std::chrono::milliseconds timeout) {
+    for (read_engine *e : all()) {
+        if (!e->wait(timeout)) return false;
+    }
+    return true;
+}
+
+void device_scheduler::discard() {
+    for (read_engine *e : all()) e->discard();
+}
+
+void device_scheduler::cancel() {
+    for (read_engine *e : all()) e->cancel();
+}
+
+const char *device_scheduler::name() const {
+    return label.c_str();
+}
+
+size_t device_scheduler::scheduled() {
+    std::lock_guard<std::mutex> lg(lock);
+    return engines.size();
+}
@@ -0,0 +1,77 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "readengine.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+/* how many files of each device are listed or read at once: a spinning disk seeks itself to
+ * a crawl under many readers and a network share has its own latency, while flash devices
+ * take as many as there are threads; devices are told apart by st_dev */
+class device_limits {
+public:
+    enum kind {SOLID, ROTATIONAL, NETWORK};
+    static const size_t UNLIMITED = 0;
+
+    struct device {
+        kind k;
+        size_t limit;
+        bool set;                     // the limit was given, not guessed from the kind
+    };
+
+private:
+    mutable std::mutex lock;
+    mutable std::map<uint64_t, device> devices;
+    size_t rotational, network;
+
+public:
+    device_limits();
+
+    /* the limit of the device path is on, false if it cannot be stat'ed */
+    bool set(const std::string &path, size_t limit);
+    /* path is any file or directory on the device, it is looked at once per device */
+    size_t get(uint64_t dev, const std::string &path) const;
+    std::map<uint64_t, device> known() const;
+    void forget();
+
+    static kind probe(uint64_t dev, const std::string &path);
+    static const char *name(kind k);
+    static std::string name(uint64_t dev);
+};
+
+/* one read engine per device, so a slow device fills only its own queue; devices without
+ * a limit share one engine set up like an unscheduled scan */
+class device_scheduler : public read_engine {
+private:
+    kind reader;
+    const device_limits &limits;
+    io_governor &governor;
+    std::atomic<uint64_t> *bytes;
+    std::unique_ptr<read_engine> shared;
+    std::map<uint64_t, std::unique_ptr<read_engine>> engines;
+    std::mutex lock;
+    std::string label;
+
+    read_engine &engine_for(const read_job &job);
+    std::vector<read_engine *> all();
+
+public:
+    device_scheduler(kind reader, size_t threads, size_t depth, const device_limits &limits,
+                     io_governor &governor, std::atomic<uint64_t> *bytes);
+
+    bool push(read_job &&job, std::chrono::milliseconds timeout) override;
+    bool wait(std::chrono::milliseconds timeout) override;
+    void discard() override;
+    void cancel() override;
+    const char *name() const override;
+    /* engines of limited devices, the shared one is not counted */
+    size_t scheduled();
+};
+
+#endif // DEVICES_H
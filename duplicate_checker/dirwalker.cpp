@@ -0,0 +1,250 @@
+#include "dirwalker.h"
+#include "profiler.h"
+
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <cstring>
+
+const size_t DENTS_BUFFER = 64 * 1024;
+const std::chrono::milliseconds PROGRESS_PERIOD(100);
+const size_t TAKE_SCAN = 64;  // directories looked at for one of a device below its limit
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+dir_walker::dir_walker(size_t threads) : threads(threads), spill_limit(0), limits(nullptr), filter(&defaults) {
+    for (auto &r : rejected) r = 0;
+    if (this->threads == 0) this->threads = std::thread::hardware_concurrency();
+    if (this->threads == 0) this->threads = 1;
+}
+
+void dir_walker::walk(std::deque<dir_task> &dirs, file_table &table,
+                      const std::function<bool()> &interrupted,
+                      const std::function<void(size_t, size_t)> &progress) {
+    workers.clear();
+    this->table = &table;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(new worker());
+    }
+    for (size_t i = 0; i < dirs.size(); i++) {
+        workers[i % threads]->dirs.push_back(std::move(dirs[i]));
+    }
+    pending = dirs.size();
+    dirs.clear();
+    dirs_done = files_done = 0;
+    for (auto &r : rejected) r = 0;
+    stopped = false;
+    running = threads;
+    posted = 0;
+    sleeping = 0;
+
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads; i++) {
+        pool.emplace_back(&dir_walker::run, this, i, std::cref(interrupted));
+    }
+    {
+        std::unique_lock<std::mutex> lk(finish_lock);
+        while (!finish.wait_for(lk, PROGRESS_PERIOD, [this] { return running == 0; })) {
+            progress(dirs_done, files_done);
+        }
+    }
+    for (auto &t : pool) t.join();
+    progress(dirs_done, files_done);
+
+    /* whatever was not listed is handed back, so the walk can be resumed */
+    for (auto &w : workers) {
+        for (auto &d : w->dirs) dirs.push_back(std::move(d));
+        table.append(w->found);
+    }
+    workers.clear();
+}
+
+void dir_walker::run(size_t id, const std::function<bool()> &interrupted) {
+    std::vector<char> buffer(DENTS_BUFFER);
+    dir_task dir;
+    while (!stopped) {
+        /* read before looking, so whatever is posted while looking is not slept through */
+        uint64_t seen = posted;
+        if (take(id, dir)) {
+            if (interrupted()) {
+                leave(dir);
+                stopped = true;
+                {
+                    std::lock_guard<std::mutex> lg(workers[id]->lock);
+                    workers[id]->dirs.push_back(std::move(dir));
+                }
+                wake();
+                break;
+            }
+            list(id, dir, buffer);
+            leave(dir);
+            dirs_done++;
+            if (--pending == 0) wake();
+        } else if (pending == 0) {
+            break;
+        } else {
+            /* the directories left are being listed, or all wait for a busy device */
+            std::unique_lock<std::mutex> lk(idle_lock);
+            sleeping++;
+            idle.wait(lk, [this, seen] { return posted != seen || pending == 0 || stopped; });
+            sleeping--;
+        }
+    }
+    std::lock_guard<std::mutex> lg(finish_lock);
+    running--;
+    finish.notify_all();
+}
+
+void dir_walker::wake() {
+    posted++;
+    if (sleeping == 0) return;
+    std::lock_guard<std::mutex> lg(idle_lock);
+    idle.notify_all();
+}
+
+bool dir_walker::take(size_t id, dir_task &dir) {
+    /* own deque is used as a stack (depth-first, warm dentry cache),
+     * stealing takes the oldest directory, which is usually the biggest subtree */
+    for (size_t k = 0; k < threads; k++) {
+        worker &w = *workers[(id + k) % threads];
+        std::lock_guard<std::mutex> lg(w.lock);
+        if (w.dirs.empty()) continue;
+        /* a directory of a device at its limit is passed over for the next one */
+        size_t n = std::min(w.dirs.size(), (limits != nullptr) ? TAKE_SCAN : 1);
+        for (size_t i = 0; i < n; i++) {
+            auto at = (k == 0) ? w.dirs.end() - 1 - i : w.dirs.begin() + i;
+            if (!admit(*at)) continue;
+            dir = std::move(*at);
+            w.dirs.erase(at);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool dir_walker::admit(const dir_task &dir) {
+    if (limits == nullptr || dir.dev == 0) return true;
+    size_t limit = limits->get(dir.dev, dir.path);
+    if (limit == device_limits::UNLIMITED) return true;
+    std::lock_guard<std::mutex> lg(gate_lock);
+    size_t &busy = listing[dir.dev];
+    if (busy >= limit) return false;
+    busy++;
+    return true;
+}
+
+void dir_walker::leave(const dir_task &dir) {
+    if (limits == nullptr || dir.dev == 0) return;
+    std::lock_guard<std::mutex> lg(gate_lock);
+    auto l = listing.find(dir.dev);
+    if (l != listing.end() && l->second > 0) l->second--;
+    wake();
+}
+
+void dir_walker::list(size_t id, const dir_task &dir, std::vector<char> &buffer) {
+    bool profiling = profiler::enabled();
+    int64_t started = (profiling) ? profiler::now() : 0;
+    uint64_t calls = 1, found = 0;
+    int fd = openat(AT_FDCWD, dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        if (profiling) profiler::count(calls);
+        return;
+    }
+    worker &w = *workers[id];
+    const walk_filter &f = *filter;
+    /* subdirectories are taken to be on the same device, a mount point is corrected when it is listed */
+    struct stat self;
+    uint64_t dev = dir.dev;
+    bool one_device = f.one_device && fstat(fd, &self) == 0;
+    if (one_device || (limits != nullptr && fstat(fd, &self) == 0)) dev = self.st_dev;
+    std::string prefix = (!dir.path.empty() && dir.path.back() == '/') ? dir.path : dir.path + "/";
+    bool paths = f.needs_path();
+    std::string path;
+    std::vector<char> names;
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        calls++;
+        if (n <= 0) break;
+        for (long pos = 0; pos < n;) {
+            auto *d = reinterpret_cast<linux_dirent64 *>(buffer.data() + pos);
+            pos += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            /* hidden entries are skipped like QDir does by default */
+            walk_filter::reason r = f.check_name(name);
+            if (r != walk_filter::NONE) {
+                rejected[r]++;
+                continue;
+            }
+            if (paths) path = prefix + name;
+            unsigned char type = d->d_type;
+            struct stat st;
+            bool stated = false;
+            if (type == DT_UNKNOWN || type == DT_REG) {
+                calls++;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                stated = true;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type == DT_DIR) {
+                /* a pruned directory is never opened, a mount point is told by one stat */
+                r = f.check_dir(name, path);
+                if (r == walk_filter::NONE && one_device) {
+                    calls += !stated;
+                    if (!stated && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    if (static_cast<uint64_t>(st.st_dev) != dev) r = walk_filter::OTHER_DEVICE;
+                }
+                if (r != walk_filter::NONE) {
+                    rejected[r]++;
+                    continue;
+                }
+                names.insert(names.end(), name, name + strlen(name) + 1);
+            } else if (type == DT_REG && stated) {
+                r = f.check_file(name, path, st);
+                if (r != walk_filter::NONE) {
+                    rejected[r]++;
+                    continue;
+                }
+                uint64_t at = w.found.intern(name, strlen(name));
+                w.found.add_file(dir.id, at, st.st_size, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec,
+                                  st.st_dev, st.st_ino, st.st_nlink);
+                if (listener) listener(prefix, name, st);
+                files_done++;
+                found++;
+            }
+        }
+    }
+    close(fd);
+    if (spill && w.found.memory() > spill_limit / threads && spill(w.found)) w.found.clear();
+    if (profiling) {
+        profiler::count(calls + 1, 0, found);
+        profiler::directory(dir.path, started, profiler::now() - started);
+    }
+    if (names.empty()) return;
+
+    std::vector<dir_task> tasks;
+    {
+        std::lock_guard<std::mutex> lg(table_lock);
+        for (size_t k = 0; k < names.size(); k += strlen(names.data() + k) + 1) {
+            const char *name = names.data() + k;
+            tasks.push_back({table->add_dir(dir.id, name, strlen(name)), prefix + name, dev});
+        }
+    }
+    pending += tasks.size();
+    {
+        std::lock_guard<std::mutex> lg(w.lock);
+        for (auto &t : tasks) w.dirs.push_back(std::move(t));
+    }
+    wake();
+}
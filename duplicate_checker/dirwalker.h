@@ -0,0 +1,98 @@
+#ifndef DIRWALKER_H
+#define DIRWALKER_H
+
+#include "filetable.h"
+#include "devices.h"
+#include "walkfilter.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <map>
+
+struct stat;
+
+struct dir_task {
+    uint32_t id;              // directory id in the file table
+    std::string path;
+    uint64_t dev = 0;         // device it is on as far as known, 0 if not
+};
+
+class dir_walker {
+public:
+    /* gets the directory path with a trailing slash, the name and the stat of a regular file */
+    typedef std::function<void(const std::string &prefix, const char *name, const struct stat &st)> file_listener;
+    /* gets the files one walking thread found so far, true if they were written out and can be dropped */
+    typedef std::function<bool(const file_table &found)> spill_listener;
+
+private:
+    struct worker {
+        std::mutex lock;
+        std::deque<dir_task> dirs;
+        file_table found;         // directories of these files are registered in the shared table
+    };
+
+    size_t threads;
+    std::vector<std::unique_ptr<worker>> workers;
+    file_table *table;
+    std::mutex table_lock;
+    std::atomic<size_t> pending;      // directories pushed but not yet listed
+    std::atomic<size_t> dirs_done;
+    std::atomic<size_t> files_done;
+    std::atomic<bool> stopped;
+    std::atomic<size_t> running;
+    std::mutex finish_lock;
+    std::condition_variable finish;
+    std::atomic<uint64_t> posted;     // bumped whenever an idle thread may find something to do
+    std::atomic<size_t> sleeping;
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    file_listener listener;
+    spill_listener spill;
+    size_t spill_limit;
+    const device_limits *limits;
+    walk_filter defaults;
+    const walk_filter *filter;
+    std::atomic<uint64_t> rejected[walk_filter::REASONS];
+    std::mutex gate_lock;
+    std::map<uint64_t, size_t> listing;   // directories being listed per device
+
+    bool admit(const dir_task &dir);
+    void leave(const dir_task &dir);
+    void run(size_t id, const std::function<bool()> &interrupted);
+    void wake();
+    bool take(size_t id, dir_task &dir);
+    void list(size_t id, const dir_task &dir, std::vector<char> &buffer);
+
+public:
+    explicit dir_walker(size_t threads = 0);
+
+    /* the listener is called from the walking threads, it has to be thread-safe */
+    void set_listener(file_listener listener) { this->listener = std::move(listener); }
+    /* the files a thread found are handed to spill once they take more than its share of limit bytes,
+     * so the walk never holds much more than that; spill is called from the walking threads */
+    void set_spill(size_t limit, spill_listener spill) {
+        spill_limit = limit;
+        this->spill = std::move(spill);
+    }
+    /* directories of a limited device are listed by at most that many threads at once */
+    void set_limits(const device_limits *limits) { this->limits = limits; }
+    /* entries the filter rejects are counted and left out, the filter has to outlive the walk;
+     * without one only hidden entries are */
+    void set_filter(const walk_filter *filter) { this->filter = (filter != nullptr) ? filter : &defaults; }
+    /* entries rejected by the last walk for this reason */
+    uint64_t rejections(walk_filter::reason r) const { return rejected[r]; }
+
+    /* walks every directory from dirs, registering subdirectories and regular files in table;
+     * if interrupted() becomes true, unlisted directories are left in dirs */
+    void walk(std::deque<dir_task> &dirs, file_table &table,
+              const std::function<bool()> &interrupted,
+              const std::function<void(size_t, size_t)> &progress);
+};
+
+#endif // DIRWALKER_H
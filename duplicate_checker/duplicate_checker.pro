@@ -22,15 +22,16 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(scancore.pri)
 
 SOURCES += \
         main.cpp \
         mainwindow.cpp \
-    scantools.cpp
+    resultmodel.cpp
 
 HEADERS += \
         mainwindow.h \
-    scantools.h
+    resultmodel.h
 
 FORMS += \
         mainwindow.ui
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Benchmarks of the scanning stages on synthetic trees
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = duplicate_checker_bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(scancore.pri)
+
+SOURCES += \
+        bench.cpp \
+    treegen.cpp
+
+HEADERS += \
+    treegen.h
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Headless front end of the scanning core
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = duplicate_checker_cli
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(scancore.pri)
+
+SOURCES += \
+        cli.cpp
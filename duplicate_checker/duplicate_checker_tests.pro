@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Tests of the scanning core, run the binary: it exits with 1 on a failure
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = duplicate_checker_tests
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(scancore.pri)
+
+SOURCES += \
+        tests.cpp
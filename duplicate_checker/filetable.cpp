@@ -0,0 +1,224 @@
+#include "filetable.h"
+
+#include <algorithm>
+#include <cstring>
+
+uint64_t file_table::intern(const char *s, size_t length) {
+    uint64_t at = arena.size();
+    arena.insert(arena.end(), s, s + length);
+    arena.push_back('\0');
+    return at;
+}
+
+uint32_t file_table::add_dir(uint32_t parent, const char *name, size_t length) {
+    return add_dir_interned(parent, intern(name, length));
+}
+
+uint32_t file_table::add_dir_interned(uint32_t parent, uint64_t name) {
+    dir_parent.push_back(parent);
+    dir_name.push_back(name);
+    return static_cast<uint32_t>(dir_parent.size() - 1);
+}
+
+uint32_t file_table::add_file(uint32_t dir, uint64_t name, int64_t size, int64_t mtime, uint64_t dev, uint64_t inode, uint32_t nlink) {
+    this->dir.push_back(dir);
+    this->name.push_back(name);
+    this->size.push_back(size);
+    this->mtime.push_back(mtime);
+    this->dev.push_back(dev);
+    this->inode.push_back(inode);
+    this->nlink.push_back(nlink);
+    hash.emplace_back();
+    flags.push_back(0);
+    order.push_back(static_cast<uint32_t>(this->size.size() - 1));
+    return order.back();
+}
+
+void file_table::append(const file_table &other) {
+    uint64_t shift = arena.size();
+    uint32_t first = static_cast<uint32_t>(files());
+    arena.insert(arena.end(), other.arena.begin(), other.arena.end());
+    dir.insert(dir.end(), other.dir.begin(), other.dir.end());
+    for (uint64_t n : other.name) name.push_back(n + shift);
+    size.insert(size.end(), other.size.begin(), other.size.end());
+    mtime.insert(mtime.end(), other.mtime.begin(), other.mtime.end());
+    dev.insert(dev.end(), other.dev.begin(), other.dev.end());
+    inode.insert(inode.end(), other.inode.begin(), other.inode.end());
+    nlink.insert(nlink.end(), other.nlink.begin(), other.nlink.end());
+    hash.insert(hash.end(), other.hash.begin(), other.hash.end());
+    flags.insert(flags.end(), other.flags.begin(), other.flags.end());
+    for (uint32_t i = 0; i < other.files(); i++) order.push_back(first + i);
+}
+
+std::string file_table::dir_path(uint32_t d) const {
+    std::vector<uint32_t> chain;
+    for (; d != NO_DIR; d = dir_parent[d]) chain.push_back(d);
+    std::string p;
+    for (size_t k = chain.size(); k-- > 0;) {
+        const char *part = dir_name_of(chain[k]);
+        if (!p.empty() && p.back() != '/') p.push_back('/');
+        p.append(part);
+    }
+    return p;
+}
+
+std::string file_table::path(uint32_t file) const {
+    std::string p = dir_path(dir[file]);
+    if (!p.empty() && p.back() != '/') p.push_back('/');
+    p.append(name_of(file));
+    return p;
+}
+
+void file_table::save(checkpoint_writer &out) const {
+    out.put(arena);
+    out.put(dir_parent);
+    out.put(dir_name);
+    out.put(dir);
+    out.put(name);
+    out.put(size);
+    out.put(mtime);
+    out.put(dev);
+    out.put(inode);
+    out.put(nlink);
+    out.put(hash);
+    out.put(flags);
+    out.put(order);
+}
+
+bool file_table::load(checkpoint_reader &in) {
+    clear();
+    if (!(in.get(arena) && in.get(dir_parent) && in.get(dir_name) && in.get(dir) && in.get(name) && in.get(size)
+          && in.get(mtime) && in.get(dev) && in.get(inode) && in.get(nlink) && in.get(hash) && in.get(flags) && in.get(order))) {
+        clear();
+        return false;
+    }
+    size_t n = size.size();
+    bool fits = dir_name.size() == dir_parent.size() && dir.size() == n && name.size() == n && mtime.size() == n
+            && dev.size() == n && inode.size() == n && nlink.size() == n && hash.size() == n && flags.size() == n
+            && order.size() <= n && (arena.empty() || arena.back() == '\0');
+    for (uint32_t d = 0; fits && d < dirs(); d++) {
+        fits = dir_name[d] < arena.size() && (dir_parent[d] == NO_DIR || dir_parent[d] < d);
+    }
+    for (uint32_t f = 0; fits && f < n; f++) {
+        fits = dir[f] < dirs() && name[f] < arena.size();
+    }
+    /* the working set shrinks from sorting by size on, it is shorter than the columns then */
+    for (size_t k = 0; fits && k < order.size(); k++) {
+        fits = order[k] < n;
+    }
+    if (!fits) clear();
+    return fits;
+}
+
+template <typename T>
+static void put_tail(checkpoint_writer &out, const std::vector<T> &values, size_t from) {
+    out.put(values.data() + from, values.size() - from);
+}
+
+void file_table::save_changes(checkpoint_writer &out, const extent &from, const std::vector<uint32_t> &changed,
+                              size_t first, size_t last) const {
+    put_tail(out, arena, from.arena);
+    put_tail(out, dir_parent, from.dirs);
+    put_tail(out, dir_name, from.dirs);
+    put_tail(out, dir, from.files);
+    put_tail(out, name, from.files);
+    put_tail(out, size, from.files);
+    put_tail(out, mtime, from.files);
+    put_tail(out, dev, from.files);
+    put_tail(out, inode, from.files);
+    put_tail(out, nlink, from.files);
+    put_tail(out, hash, from.files);
+    put_tail(out, flags, from.files);
+    std::vector<digest> h;
+    std::vector<uint8_t> fl;
+    for (uint32_t f : changed) {
+        h.push_back(hash[f]);
+        fl.push_back(flags[f]);
+    }
+    out.put(changed);
+    out.put(h);
+    out.put(fl);
+    out.put<uint64_t>(first);
+    out.put(order.data() + first, last - first);
+}
+
+bool file_table::load_changes(checkpoint_reader &in) {
+    file_table t;
+    std::vector<uint32_t> changed;
+    std::vector<digest> h;
+    std::vector<uint8_t> fl;
+    std::vector<uint32_t> o;
+    uint64_t first;
+    if (!(in.get(t.arena) && in.get(t.dir_parent) && in.get(t.dir_name) && in.get(t.dir) && in.get(t.name)
+          && in.get(t.size) && in.get(t.mtime) && in.get(t.dev) && in.get(t.inode) && in.get(t.nlink) && in.get(t.hash)
+          && in.get(t.flags) && in.get(changed) && in.get(h) && in.get(fl) && in.get(first) && in.get(o))) return false;
+    /* ids in the changes count from the start of this table */
+    size_t bytes = arena.size() + t.arena.size(), d0 = dirs(), n = t.size.size(), total = files() + n;
+    bool fits = t.dir_name.size() == t.dir_parent.size() && t.dir.size() == n && t.name.size() == n && t.mtime.size() == n
+            && t.dev.size() == n && t.inode.size() == n && t.nlink.size() == n && t.hash.size() == n && t.flags.size() == n
+            && h.size() == changed.size() && fl.size() == changed.size() && first <= order.size()
+            && (t.arena.empty() || t.arena.back() == '\0');
+    for (size_t d = 0; fits && d < t.dirs(); d++) {
+        fits = t.dir_name[d] < bytes && (t.dir_parent[d] == NO_DIR || t.dir_parent[d] < d0 + d);
+    }
+    for (size_t f = 0; fits && f < n; f++) fits = t.dir[f] < d0 + t.dirs() && t.name[f] < bytes;
+    for (size_t k = 0; fits && k < changed.size(); k++) fits = changed[k] < total;
+    for (size_t k = 0; fits && k < o.size(); k++) fits = o[k] < total;
+    if (!fits) return false;
+    arena.insert(arena.end(), t.arena.begin(), t.arena.end());
+    dir_parent.insert(dir_parent.end(), t.dir_parent.begin(), t.dir_parent.end());
+    dir_name.insert(dir_name.end(), t.dir_name.begin(), t.dir_name.end());
+    dir.insert(dir.end(), t.dir.begin(), t.dir.end());
+    name.insert(name.end(), t.name.begin(), t.name.end());
+    size.insert(size.end(), t.size.begin(), t.size.end());
+    mtime.insert(mtime.end(), t.mtime.begin(), t.mtime.end());
+    dev.insert(dev.end(), t.dev.begin(), t.dev.end());
+    inode.insert(inode.end(), t.inode.begin(), t.inode.end());
+    nlink.insert(nlink.end(), t.nlink.begin(), t.nlink.end());
+    hash.insert(hash.end(), t.hash.begin(), t.hash.end());
+    flags.insert(flags.end(), t.flags.begin(), t.flags.end());
+    for (size_t k = 0; k < changed.size(); k++) {
+        hash[changed[k]] = h[k];
+        flags[changed[k]] = fl[k];
+    }
+    if (order.size() < first + o.size()) order.resize(first + o.size());
+    std::copy(o.begin(), o.end(), order.begin() + first);
+    return true;
+}
+
+void file_table::reserve(size_t files, size_t bytes) {
+    arena.reserve(bytes);
+    dir.reserve(files);
+    name.reserve(files);
+    size.reserve(files);
+    mtime.reserve(files);
+    dev.reserve(files);
+    inode.reserve(files);
+    nlink.reserve(files);
+    hash.reserve(files);
+    flags.reserve(files);
+    order.reserve(files);
+}
+
+void file_table::clear() {
+    /* a fresh table, so the memory is really given back */
+    *this = file_table();
+}
+
+file_table file_table::directories() const {
+    file_table t;
+    t.dir_parent = dir_parent;
+    t.dir_name.reserve(dir_name.size());
+    for (uint64_t n : dir_name) {
+        const char *s = arena.data() + n;
+        t.dir_name.push_back(t.intern(s, strlen(s)));
+    }
+    return t;
+}
+
+size_t file_table::memory() const {
+    return arena.capacity() + dir_parent.capacity() * sizeof(uint32_t) + (dir_name.capacity() + name.capacity()) * sizeof(uint64_t)
+            + (dir.capacity() + nlink.capacity() + order.capacity()) * sizeof(uint32_t)
+            + (size.capacity() + mtime.capacity() + dev.capacity() + inode.capacity()) * sizeof(int64_t)
+            + hash.capacity() * sizeof(digest) + flags.capacity();
+}
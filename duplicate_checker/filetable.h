@@ -0,0 +1,89 @@
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include "hasher.h"
+#include "checkpoint.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/* scanned files stored column by column; names of files and directories are kept
+ * in one byte arena, a path is rebuilt from the chain of parent directories; names
+ * are found by 64-bit offsets, the arena of a huge scan goes past 4 GiB */
+class file_table {
+private:
+    std::vector<char> arena;
+    std::vector<uint32_t> dir_parent;
+    std::vector<uint64_t> dir_name;
+
+public:
+    static const uint32_t NO_DIR = UINT32_MAX;
+    enum flag : uint8_t {SKIP = 1, CANDIDATE = 2, HASHED = 4, DUPLICATED = 8, LINKED = 16};
+
+    /* columns, indexed by file id */
+    std::vector<uint32_t> dir;
+    std::vector<uint64_t> name;
+    std::vector<int64_t> size;
+    std::vector<int64_t> mtime;       // nanoseconds since epoch
+    std::vector<uint64_t> dev, inode;
+    std::vector<uint32_t> nlink;
+    std::vector<digest> hash;
+    std::vector<uint8_t> flags;
+
+    /* ids of the files still in the working set, in working order; every sort permutes only
+     * this and files that cannot have a duplicate any more are dropped from it */
+    std::vector<uint32_t> order;
+
+    uint64_t intern(const char *s, size_t length);
+    uint32_t add_dir(uint32_t parent, const char *name, size_t length);
+    uint32_t add_dir_interned(uint32_t parent, uint64_t name);
+    uint32_t add_file(uint32_t dir, uint64_t name, int64_t size, int64_t mtime, uint64_t dev, uint64_t inode, uint32_t nlink);
+    /* appends the files of a table whose directories are registered in this one */
+    void append(const file_table &other);
+
+    size_t files() const { return size.size(); }
+    size_t dirs() const { return dir_parent.size(); }
+    const char *name_of(uint32_t file) const { return arena.data() + name[file]; }
+    const char *dir_name_of(uint32_t d) const { return arena.data() + dir_name[d]; }
+    uint32_t parent_of(uint32_t d) const { return dir_parent[d]; }
+    std::string dir_path(uint32_t d) const;
+    std::string path(uint32_t file) const;
+
+    bool same(uint32_t f1, uint32_t f2) const { return size[f1] == size[f2] && hash[f1] == hash[f2]; }
+    bool same_inode(uint32_t f1, uint32_t f2) const { return dev[f1] == dev[f2] && inode[f1] == inode[f2]; }
+    bool inode_less(uint32_t f1, uint32_t f2) const {
+        return dev[f1] < dev[f2] || (dev[f1] == dev[f2] && inode[f1] < inode[f2]);
+    }
+    bool has(uint32_t file, flag f) const { return flags[file] & f; }
+    void set(uint32_t file, flag f, bool value = true) {
+        flags[file] = (value) ? (flags[file] | f) : (flags[file] & ~f);
+    }
+
+    /* how far each part of the table reaches, to write out only what comes after */
+    struct extent {
+        size_t arena, dirs, files;
+    };
+    extent end() const { return {arena.size(), dirs(), files()}; }
+
+    void save(checkpoint_writer &out) const;
+    /* false if the columns read do not fit together */
+    bool load(checkpoint_reader &in);
+    /* writes the names, directories and files added since from, the digests and flags of the
+     * changed files and order[first, last) */
+    void save_changes(checkpoint_writer &out, const extent &from, const std::vector<uint32_t> &changed,
+                      size_t first, size_t last) const;
+    /* applies what save_changes wrote to the table as it was then; false, and the table
+     * left as it was, if the changes do not fit it */
+    bool load_changes(checkpoint_reader &in);
+
+    void reserve(size_t files, size_t bytes);
+    void clear();
+    /* drops every file but keeps the directories, their names are copied to a fresh arena */
+    void clear_files() { *this = directories(); }
+    /* a table with the directories of this one, under the same ids, and no files */
+    file_table directories() const;
+    size_t memory() const;
+};
+
+#endif // FILETABLE_H
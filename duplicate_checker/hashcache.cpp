@@ -0,0 +1,191 @@
+#include "hashcache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char MAGIC[4] = {'D', 'C', 'H', 'C'};
+const uint32_t VERSION = 1;
+const size_t DEFAULT_LIMIT = 1024ULL * 1024 * 1024;
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t algorithm;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+static bool key_less(const cache_record &r1, const cache_record &r2) {
+    return r1.dev < r2.dev || (r1.dev == r2.dev && r1.inode < r2.inode);
+}
+
+hash_cache::hash_cache() : algorithm(0), now(0), limit(DEFAULT_LIMIT), map(nullptr), map_length(0),
+                           table(nullptr), table_size(0), hits(0), misses(0), stored(0) {}
+
+hash_cache::~hash_cache() {
+    unmap();
+}
+
+void hash_cache::unmap() {
+    if (map != nullptr) munmap(map, map_length);
+    map = nullptr;
+    map_length = 0;
+    table = nullptr;
+    table_size = 0;
+}
+
+bool hash_cache::open(const std::string &path, hash_algorithm algorithm) {
+    close();
+    this->path = path;
+    this->algorithm = algorithm;
+    now = time(nullptr);
+    hits = misses = stored = 0;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return true; // no cache yet, it is created on save
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(cache_header)) {
+        map_length = st.st_size;
+        map = mmap(nullptr, map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = nullptr;
+    }
+    ::close(fd);
+    if (map == nullptr) {
+        map_length = 0;
+        return true;
+    }
+    auto *header = static_cast<cache_header *>(map);
+    size_t count = (map_length - sizeof(cache_header)) / sizeof(cache_record);
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION
+            || header->algorithm != this->algorithm || header->count > count) {
+        /* foreign or stale file, it is rebuilt from this scan */
+        unmap();
+        return true;
+    }
+    table = reinterpret_cast<cache_record *>(static_cast<char *>(map) + sizeof(cache_header));
+    table_size = header->count;
+    madvise(map, map_length, MADV_RANDOM);
+    return true;
+}
+
+cache_record *hash_cache::find(uint64_t dev, uint64_t inode) const {
+    cache_record key;
+    key.dev = dev;
+    key.inode = inode;
+    cache_record *it = std::lower_bound(table, table + table_size, key, key_less);
+    if (it == table + table_size || it->dev != dev || it->inode != inode) return nullptr;
+    return it;
+}
+
+bool hash_cache::lookup(uint64_t dev, uint64_t inode, int64_t size, int64_t mtime, int stage, digest &d) {
+    cache_record *r = find(dev, inode);
+    if (r == nullptr || r->size != size || r->mtime != mtime || !(r->stages >> stage & 1)) {
+        misses++;
+        return false;
+    }
+    r->used = now; // private mapping, written back on save
+    d = r->digests[stage];
+    hits++;
+    return true;
+}
+
+bool hash_cache::peek(uint64_t dev, uint64_t inode, int64_t size, int64_t mtime, int stage, digest &d) const {
+    const cache_record *r = find(dev, inode);
+    if (r == nullptr || r->size != size || r->mtime != mtime || !(r->stages >> stage & 1)) return false;
+    d = r->digests[stage];
+    return true;
+}
+
+void hash_cache::store(uint64_t dev, uint64_t inode, int64_t size, int64_t mtime, int stage, const digest &d) {
+    std::lock_guard<std::mutex> lg(lock);
+    auto it = updates.find(std::make_pair(dev, inode));
+    if (it == updates.end()) {
+        cache_record r;
+        memset(&r, 0, sizeof(r));
+        cache_record *old = find(dev, inode);
+        if (old != nullptr && old->size == size && old->mtime == mtime) r = *old;
+        r.dev = dev;
+        r.inode = inode;
+        r.size = size;
+        r.mtime = mtime;
+        it = updates.emplace(std::make_pair(dev, inode), r).first;
+    }
+    it->second.used = now;
+    it->second.stages |= 1u << stage;
+    it->second.digests[stage] = d;
+    stored++;
+}
+
+bool hash_cache::save() {
+    if (!is_open()) return false;
+    std::vector<cache_record> merged;
+    {
+        std::lock_guard<std::mutex> lg(lock);
+        merged.reserve(table_size + updates.size());
+        size_t k = 0;
+        for (auto &u : updates) {
+            while (k < table_size && key_less(table[k], u.second)) merged.push_back(table[k++]);
+            if (k < table_size && !key_less(u.second, table[k])) k++;
+            merged.push_back(u.second);
+        }
+        while (k < table_size) merged.push_back(table[k++]);
+        updates.clear();
+    }
+    size_t capacity = (limit > sizeof(cache_header)) ? (limit - sizeof(cache_header)) / sizeof(cache_record) : 0;
+    if (merged.size() > capacity) {
+        /* least recently used records go first */
+        std::nth_element(merged.begin(), merged.begin() + capacity, merged.end(), [](const cache_record &r1, const cache_record &r2) {
+            return r1.used > r2.used;
+        });
+        merged.resize(capacity);
+        std::sort(merged.begin(), merged.end(), key_less);
+    }
+
+    cache_header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.algorithm = algorithm;
+    header.reserved = 0;
+    header.count = merged.size();
+    std::string tmp = path + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if (out == nullptr) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+            && fwrite(merged.data(), sizeof(cache_record), merged.size(), out) == merged.size();
+    ok = fflush(out) == 0 && ok;
+    ok = fsync(fileno(out)) == 0 && ok;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    /* keep serving lookups from the new table */
+    std::string saved = path;
+    hash_algorithm a = static_cast<hash_algorithm>(algorithm);
+    size_t h = hits, m = misses, s = stored;
+    open(saved, a);
+    hits = h;
+    misses = m;
+    stored = s;
+    return true;
+}
+
+void hash_cache::close() {
+    unmap();
+    std::lock_guard<std::mutex> lg(lock);
+    updates.clear();
+    path.clear();
+}
+
+bool hash_cache::invalidate() {
+    if (!is_open()) return false;
+    std::string p = path;
+    close();
+    return unlink(p.c_str()) == 0 || errno == ENOENT;
+}
@@ -0,0 +1,64 @@
+#ifndef HASHCACHE_H
+#define HASHCACHE_H
+
+#include "hasher.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+
+struct cache_record {
+    uint64_t dev, inode;
+    int64_t size, mtime;
+    int64_t used;             // last scan which needed the record, for eviction
+    uint32_t stages;          // bit i is set when digests[i] is valid
+    uint32_t reserved;
+    digest digests[4];        // chained head, tail and middle digests, then the full one
+};
+
+/* sorted table of records in one file, mapped copy-on-write while a scan runs;
+ * new digests are merged in and the file is replaced atomically on save */
+class hash_cache {
+private:
+    std::string path;
+    uint32_t algorithm;
+    int64_t now;
+    size_t limit;
+
+    void *map;
+    size_t map_length;
+    cache_record *table;
+    size_t table_size;
+
+    std::mutex lock;
+    std::map<std::pair<uint64_t, uint64_t>, cache_record> updates;
+    std::atomic<size_t> hits, misses, stored;
+
+    cache_record *find(uint64_t dev, uint64_t inode) const;
+    void unmap();
+
+public:
+    hash_cache();
+    ~hash_cache();
+
+    bool open(const std::string &path, hash_algorithm algorithm);
+    bool is_open() const { return !path.empty(); }
+    bool lookup(uint64_t dev, uint64_t inode, int64_t size, int64_t mtime, int stage, digest &d);
+    /* like lookup, but touches nothing, so it may run concurrently with other peeks */
+    bool peek(uint64_t dev, uint64_t inode, int64_t size, int64_t mtime, int stage, digest &d) const;
+    void store(uint64_t dev, uint64_t inode, int64_t size, int64_t mtime, int stage, const digest &d);
+    bool save();
+    void close();
+    bool invalidate();
+
+    void set_limit(size_t bytes) { limit = bytes; }
+    size_t get_hits() const { return hits; }
+    size_t get_misses() const { return misses; }
+    size_t get_stored() const { return stored; }
+    size_t get_entries() const { return table_size; }
+};
+
+#endif // HASHCACHE_H
@@ -0,0 +1,123 @@
+#include "hasher.h"
+
+#include <QCryptographicHash>
+#include <cstring>
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+#ifdef HAVE_BLAKE3
+#include <blake3.h>
+#endif
+
+const char *const NAMES[] = {"md5", "sha256", "xxh3", "blake3"};
+
+static digest pack(const char *data, size_t size) {
+    digest d{};
+    memcpy(d.data(), data, std::min(size, d.size()));
+    return d;
+}
+
+class qt_hasher : public hasher {
+private:
+    QCryptographicHash hash;
+public:
+    explicit qt_hasher(QCryptographicHash::Algorithm algorithm) : hash(algorithm) {}
+    void add(const char *data, size_t size) override { hash.addData(data, static_cast<int>(size)); }
+    digest result() override {
+        QByteArray r = hash.result();
+        return pack(r.constData(), r.size());
+    }
+};
+
+#ifdef HAVE_XXHASH
+/* XXH3 picks its SSE2/AVX2/NEON kernel when libxxhash is built */
+class xxh3_hasher : public hasher {
+private:
+    XXH3_state_t *state;
+public:
+    xxh3_hasher() : state(XXH3_createState()) { XXH3_128bits_reset(state); }
+    ~xxh3_hasher() override { XXH3_freeState(state); }
+    void add(const char *data, size_t size) override { XXH3_128bits_update(state, data, size); }
+    digest result() override {
+        XXH128_canonical_t c;
+        XXH128_canonicalFromHash(&c, XXH3_128bits_digest(state));
+        return pack(reinterpret_cast<const char *>(c.digest), sizeof(c.digest));
+    }
+};
+#endif
+
+#ifdef HAVE_BLAKE3
+/* libblake3 dispatches to SSE4.1/AVX2/AVX-512 at run time */
+class blake3_hasher_impl : public hasher {
+private:
+    blake3_hasher state;
+public:
+    blake3_hasher_impl() { blake3_hasher_init(&state); }
+    void add(const char *data, size_t size) override { blake3_hasher_update(&state, data, size); }
+    digest result() override {
+        digest d;
+        blake3_hasher_finalize(&state, d.data(), d.size());
+        return d;
+    }
+};
+#endif
+
+std::unique_ptr<hasher> hasher::create(hash_algorithm algorithm) {
+    switch (algorithm) {
+#ifdef HAVE_XXHASH
+        case XXH3: return std::unique_ptr<hasher>(new xxh3_hasher());
+#endif
+#ifdef HAVE_BLAKE3
+        case BLAKE3: return std::unique_ptr<hasher>(new blake3_hasher_impl());
+#endif
+        case SHA256: return std::unique_ptr<hasher>(new qt_hasher(QCryptographicHash::Sha256));
+        default: return std::unique_ptr<hasher>(new qt_hasher(QCryptographicHash::Md5));
+    }
+}
+
+bool hasher::available(hash_algorithm algorithm) {
+    switch (algorithm) {
+        case XXH3:
+#ifdef HAVE_XXHASH
+            return true;
+#else
+            return false;
+#endif
+        case BLAKE3:
+#ifdef HAVE_BLAKE3
+            return true;
+#else
+            return false;
+#endif
+        default: return true;
+    }
+}
+
+hash_algorithm hasher::best() {
+    return (available(BLAKE3)) ? BLAKE3 : MD5;
+}
+
+const char *hasher::name(hash_algorithm algorithm) {
+    return NAMES[algorithm];
+}
+
+bool hasher::parse(const std::string &name, hash_algorithm &algorithm) {
+    for (int i = MD5; i <= BLAKE3; i++) {
+        if (name == NAMES[i]) {
+            algorithm = static_cast<hash_algorithm>(i);
+            return available(algorithm);
+        }
+    }
+    return false;
+}
+
+std::string to_hex(const digest &d) {
+    static const char *DIGITS = "0123456789abcdef";
+    std::string s;
+    for (uint8_t b : d) {
+        s.push_back(DIGITS[b >> 4]);
+        s.push_back(DIGITS[b & 15]);
+    }
+    return s;
+}
@@ -0,0 +1,32 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/* every digest takes 32 bytes, shorter ones are padded with zeros */
+typedef std::array<uint8_t, 32> digest;
+
+enum hash_algorithm {MD5, SHA256, XXH3, BLAKE3};
+
+class hasher {
+public:
+    virtual ~hasher() = default;
+    virtual void add(const char *data, size_t size) = 0;
+    virtual digest result() = 0;
+
+    void add(const digest &d) { add(reinterpret_cast<const char *>(d.data()), d.size()); }
+
+    static std::unique_ptr<hasher> create(hash_algorithm algorithm);
+    static bool available(hash_algorithm algorithm);
+    static hash_algorithm best();
+    static const char *name(hash_algorithm algorithm);
+    static bool parse(const std::string &name, hash_algorithm &algorithm);
+};
+
+std::string to_hex(const digest &d);
+
+#endif // HASHER_H
@@ -0,0 +1,62 @@
+#include "hashpool.h"
+
+hash_pool::hash_pool(size_t threads, size_t depth) : depth(depth), busy(0), closing(false), canceled(false) {
+    if (threads == 0) threads = 1;
+    if (this->depth == 0) this->depth = threads;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&hash_pool::run, this);
+    }
+}
+
+hash_pool::~hash_pool() {
+    {
+        std::lock_guard<std::mutex> lg(lock);
+        closing = true;
+    }
+    has_job.notify_all();
+    for (auto &t : workers) t.join();
+}
+
+void hash_pool::run() {
+    std::unique_lock<std::mutex> lk(lock);
+    while (true) {
+        has_job.wait(lk, [this] { return closing || !jobs.empty(); });
+        if (jobs.empty()) return;
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        busy++;
+        has_room.notify_one();
+        lk.unlock();
+        job();
+        lk.lock();
+        busy--;
+        if (busy == 0 && jobs.empty()) idle.notify_all();
+    }
+}
+
+bool hash_pool::push(std::function<void()> job, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lk(lock);
+    if (!has_room.wait_for(lk, timeout, [this] { return jobs.size() < depth; })) return false;
+    jobs.push_back(std::move(job));
+    has_job.notify_one();
+    return true;
+}
+
+bool hash_pool::wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lk(lock);
+    return idle.wait_for(lk, timeout, [this] { return busy == 0 && jobs.empty(); });
+}
+
+size_t hash_pool::discard() {
+    std::unique_lock<std::mutex> lk(lock);
+    size_t dropped = jobs.size();
+    jobs.clear();
+    has_room.notify_all();
+    idle.wait(lk, [this] { return busy == 0; });
+    return dropped;
+}
+
+void hash_pool::cancel() {
+    canceled = true;
+    discard();
+}
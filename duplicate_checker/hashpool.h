@@ -0,0 +1,42 @@
+#ifndef HASHPOOL_H
+#define HASHPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+class hash_pool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    size_t depth;
+    size_t busy;
+    bool closing;
+    std::atomic<bool> canceled;
+    std::mutex lock;
+    std::condition_variable has_job, has_room, idle;
+
+    void run();
+
+public:
+    hash_pool(size_t threads, size_t depth);
+    ~hash_pool();
+
+    /* queues a job, waiting at most timeout for a free slot; false if the queue stayed full */
+    bool push(std::function<void()> job, std::chrono::milliseconds timeout);
+    /* true once the queue is empty and no job is running */
+    bool wait(std::chrono::milliseconds timeout);
+    /* drops queued jobs and waits for the running ones, returns the number of dropped jobs */
+    size_t discard();
+    /* like discard, but running jobs are asked to stop via is_canceled */
+    void cancel();
+
+    bool is_canceled() const { return canceled; }
+};
+
+#endif // HASHPOOL_H
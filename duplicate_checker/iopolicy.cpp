@@ -0,0 +1,116 @@
+#include "iopolicy.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+const char *const CACHE_MODE_NAMES[] = {"buffered", "dontneed", "direct"};
+
+bool io_policy::parse(const std::string &name, cache_mode &mode) {
+    for (int m = BUFFERED; m <= DIRECT; m++) {
+        if (name != CACHE_MODE_NAMES[m]) continue;
+        mode = static_cast<cache_mode>(m);
+        return true;
+    }
+    return false;
+}
+
+const char *io_policy::name(cache_mode mode) {
+    return CACHE_MODE_NAMES[mode];
+}
+
+io_governor::io_governor() : generation(0), loaded(0), hits(0), dropped(0), direct(0) {
+    long p = sysconf(_SC_PAGESIZE);
+    page = (p > 0) ? static_cast<size_t>(p) : ALIGNMENT;
+}
+
+void io_governor::clear() {
+    std::lock_guard<std::mutex> lg(lock);
+    next = std::chrono::steady_clock::time_point();
+    loaded = hits = dropped = direct = 0;
+}
+
+int io_governor::open(const std::string &path, bool &direct) {
+    direct = false;
+    int fd = -1;
+    if (policy.cache == io_policy::DIRECT) {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (fd >= 0) {
+            direct = true;
+            return fd;
+        }
+        if (errno != EINVAL) return -1;
+    }
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || policy.cache == io_policy::BUFFERED) return fd;
+    /* readahead would load pages past the range looked at in before, they would count as cached
+     * on the next read and stay; reads are large enough to go without it */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    return fd;
+}
+
+void io_governor::before(int fd, bool direct, int64_t offset, size_t length, window &w) {
+    if (policy.bandwidth > 0) {
+        /* every read books its slot of the shared budget, then sleeps until the slot comes */
+        std::unique_lock<std::mutex> lk(lock);
+        auto now = std::chrono::steady_clock::now();
+        auto start = std::max(next, now);
+        next = start + std::chrono::nanoseconds(length * 1000000000ULL / policy.bandwidth);
+        uint64_t g = generation;
+        woken.wait_until(lk, start, [this, g] { return generation != g; });
+    }
+    w.offset = offset / page * page;
+    w.resident.clear();
+    if (direct || policy.cache != io_policy::DONTNEED || length == 0) return;
+    size_t span = offset + length - w.offset;
+    void *m = mmap(nullptr, span, PROT_READ, MAP_SHARED, fd, w.offset);
+    if (m == MAP_FAILED) return;
+    w.resident.resize((span + page - 1) / page);
+    if (mincore(m, span, w.resident.data()) != 0) w.resident.clear();
+    munmap(m, span);
+    if (profiler::enabled()) profiler::count(3);
+}
+
+void io_governor::after(int fd, bool direct, int64_t offset, size_t length, const window &w) {
+    if (direct) {
+        this->direct += length;
+        return;
+    }
+    if (policy.cache != io_policy::DONTNEED || w.resident.empty()) {
+        loaded += length;
+        return;
+    }
+    /* runs of pages that were not cached before the read are dropped, the others are left alone */
+    uint64_t calls = 0, cached = 0;
+    int64_t end = offset + length;
+    size_t pages = std::min(w.resident.size(), static_cast<size_t>((end - w.offset + page - 1) / page));
+    for (size_t p = 0, q; p < pages; p = q) {
+        bool resident = w.resident[p] & 1;
+        q = p + 1;
+        while (q < pages && (w.resident[q] & 1) == resident) q++;
+        int64_t from = std::max<int64_t>(offset, w.offset + p * page);
+        int64_t to = std::min<int64_t>(end, w.offset + q * page);
+        if (resident) {
+            cached += to - from;
+        } else {
+            posix_fadvise(fd, w.offset + p * page, (q - p) * page, POSIX_FADV_DONTNEED);
+            calls++;
+        }
+    }
+    hits += cached;
+    loaded += length - cached;
+    dropped += length - cached;
+    if (profiler::enabled()) profiler::count(calls);
+}
+
+void io_governor::wake() {
+    {
+        std::lock_guard<std::mutex> lg(lock);
+        generation++;
+        next = std::chrono::steady_clock::time_point();
+    }
+    woken.notify_all();
+}
@@ -0,0 +1,74 @@
+#ifndef IOPOLICY_H
+#define IOPOLICY_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/* how content reads of a scan treat the page cache and the disk */
+struct io_policy {
+    enum cache_mode {BUFFERED, DONTNEED, DIRECT};
+
+    cache_mode cache;
+    uint64_t bandwidth;             // bytes per second for all reading threads together, 0 for no cap
+
+    io_policy() : cache(BUFFERED), bandwidth(0) {}
+
+    static bool parse(const std::string &name, cache_mode &mode);
+    static const char *name(cache_mode mode);
+};
+
+/* applies a policy to the reads of every thread of a scan and counts what they did to the page cache:
+ * DIRECT reads around it, DONTNEED drops again the pages a read brought in and leaves the ones
+ * that were cached before, so other processes keep their working set either way */
+class io_governor {
+public:
+    static const size_t ALIGNMENT = 4096;
+
+    /* pages of one read that were cached before it */
+    struct window {
+        int64_t offset;
+        std::vector<unsigned char> resident;
+    };
+
+private:
+    io_policy policy;
+    size_t page;
+    std::mutex lock;
+    std::condition_variable woken;
+    std::chrono::steady_clock::time_point next;
+    uint64_t generation;
+    std::atomic<uint64_t> loaded, hits, dropped, direct;
+
+public:
+    io_governor();
+
+    void set_policy(const io_policy &policy) { this->policy = policy; }
+    const io_policy &get_policy() const { return policy; }
+    void clear();
+
+    /* direct tells whether the file was opened with O_DIRECT, file systems refusing it get DONTNEED instead */
+    int open(const std::string &path, bool &direct);
+    /* waits for the bandwidth cap, then notes which pages of the range are cached already */
+    void before(int fd, bool direct, int64_t offset, size_t length, window &w);
+    /* counts the bytes read and drops what the read brought into the page cache */
+    void after(int fd, bool direct, int64_t offset, size_t length, const window &w);
+    /* cuts waits for the bandwidth cap short, so readers can notice a pause quickly */
+    void wake();
+
+    /* bytes read through the page cache that were not there before; everything read without DONTNEED */
+    uint64_t get_loaded() const { return loaded; }
+    uint64_t get_hits() const { return hits; }
+    uint64_t get_dropped() const { return dropped; }
+    uint64_t get_direct() const { return direct; }
+
+    static int64_t align_down(int64_t offset) { return offset & ~static_cast<int64_t>(ALIGNMENT - 1); }
+    static int64_t align_up(int64_t offset) { return align_down(offset + ALIGNMENT - 1); }
+};
+
+#endif // IOPOLICY_H
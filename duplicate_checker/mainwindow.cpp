@@ -9,13 +9,16 @@
 #include <QMessageBox>
 #include <QDebug>
 #include <QDateTime>
-#include <QMessageBox>
+#include <QPushButton>
 
 #include <queue>
 #include <vector>
 #include <future>
+#include <chrono>
 
 const size_t COLUMNS = 5;
+const int PROGRESS_PERIOD = 100;
+const double SIMILAR_RATIO = 0.5; // of the smaller file
 
 main_window::main_window(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow) {
     ui->setupUi(this);
@@ -37,19 +40,33 @@ main_window::main_window(QWidget *parent) : QMainWindow(parent), ui(new Ui::Main
     ui->treeWidget->header()->setSectionResizeMode(3, QHeaderView::Stretch);
     ui->treeWidget->header()->setSectionResizeMode(3, QHeaderView::Interactive);
     ui->treeWidget->header()->setSectionResizeMode(4, QHeaderView::Stretch);
+    ui->resultView->header()->setSortIndicator(-1, Qt::AscendingOrder);
+    ui->resultView->setModel(&results);
+    ui->resultView->header()->setSectionResizeMode(3, QHeaderView::Stretch);
+    show_results(false);
 
     connect(ui->actionAbout, &QAction::triggered, this, &main_window::about_slot);
+    connect(ui->actionAddRoot, &QAction::triggered, this, &main_window::add_root_slot);
     connect(ui->actionAgain, &QAction::triggered, this, &main_window::again_slot);
     connect(ui->actionCancel, &QAction::triggered, this, &main_window::cancel_slot);
     connect(ui->actionChoose, &QAction::triggered, this, &main_window::choose_slot);
+    connect(ui->actionClearCache, &QAction::triggered, this, &main_window::clear_cache_slot);
     connect(ui->actionCollision, &QAction::triggered, this, &main_window::collision_slot);
     connect(ui->actionDelete, &QAction::triggered, this, &main_window::delete_slot);
     connect(ui->actionExit, &QAction::triggered, this, &main_window::exit_slot);
     connect(ui->actionPause, &QAction::triggered, this, &main_window::pause_slot);
     connect(ui->actionRefresh, &QAction::triggered, this, &main_window::refresh_slot);
+    connect(ui->actionResume, &QAction::triggered, this, &main_window::resume_slot);
     connect(ui->actionScan, &QAction::triggered, this, &main_window::scan_slot);
+    connect(ui->actionWatch, &QAction::toggled, this, &main_window::watch_slot);
+    connect(ui->actionSimilar, &QAction::toggled, this, &main_window::similar_slot);
     connect(ui->treeWidget, &QTreeWidget::itemActivated, this, &main_window::open_slot);
+    connect(ui->resultView, &QTreeView::activated, this, &main_window::select_slot);
+    connect(ui->filterEdit, &QLineEdit::textChanged, &results, &result_model::set_filter);
+
+    connect(&progress_timer, &QTimer::timeout, this, &main_window::progress_slot);
 
+    qRegisterMetaType<std::shared_ptr<const scan_result>>();
     thread = new QThread();
     st.moveToThread(thread);
     connect(thread, &QThread::started, &st, &scantools::start);
@@ -60,10 +77,13 @@ main_window::main_window(QWidget *parent) : QMainWindow(parent), ui(new Ui::Main
     connect(&st, &scantools::finished, this, &main_window::finished_slot);
     connect(&st, &scantools::console, this, &main_window::console_slot);
     connect(&st, &scantools::add_item, this, &main_window::add_item);
-    connect(&st, &scantools::color_item, this, &main_window::color_item);
     connect(&st, &scantools::clear_items, this, &main_window::clear_items);
     connect(&st, &scantools::update_items, this, &main_window::update_items);
+    connect(&st, &scantools::results_ready, this, &main_window::results_slot);
+    connect(&st, &scantools::results_changed, this, &main_window::changed_slot);
+    QDir::setCurrent(QDir::homePath());
     st.open_directory();
+    setItemsVisible(st.has_checkpoint(), ui->actionResume);
 }
 
 main_window::~main_window() {
@@ -74,12 +94,21 @@ void main_window::about_slot() {
     QMessageBox::aboutQt(this);
 }
 
+void main_window::add_root_slot() {
+    QString dir = QFileDialog::getExistingDirectory(this, "Select Another Directory for Scanning",
+                QString(), QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
+    if (dir.isEmpty()) return;
+    st.add_root(QFileInfo(dir).canonicalFilePath());
+    console_slot(QString("directories to scan: ").append(st.get_roots().join(", ")), true, "purple");
+}
+
 void main_window::again_slot() {
-    setItemsEnabled(true, ui->actionChoose, ui->actionRefresh, ui->actionScan, ui->actionCollision);
+    setItemsEnabled(true, ui->actionChoose, ui->actionAddRoot, ui->actionRefresh, ui->actionScan, ui->actionCollision, ui->actionSimilar, ui->actionClearCache);
     setItemsEnabled(false, ui->actionPause, ui->actionCancel);
     setItemsVisible(false, ui->actionAgain, ui->actionDelete);
-    disconnect(ui->treeWidget, &QTreeWidget::itemActivated, this, &main_window::select_slot);
-    connect(ui->treeWidget, &QTreeWidget::itemActivated, this, &main_window::open_slot);
+    st.stop_watching();
+    show_results(false);
+    results.reset();
     ui->treeWidget->setEnabled(false);
     st.open_directory();
     ui->treeWidget->setEnabled(true);
@@ -87,6 +116,8 @@ void main_window::again_slot() {
 
 void main_window::cancel_slot() {
     st.cancel();
+    /* the scanning thread is not running a reclaim, it only has to see the request */
+    if (reclaiming) return;
     thread->start();
 }
 
@@ -97,6 +128,11 @@ void main_window::choose_slot() {
     st.open_directory();
 }
 
+void main_window::clear_cache_slot() {
+    auto res = long_dialog("Clear hash cache", "Hashes of all previously scanned files will be forgotten and calculated again on the next scan.");
+    if (res == QMessageBox::Ok) st.invalidate_cache();
+}
+
 void main_window::collision_slot() {
     st.set_mode(!st.is_mode());
     ui->actionCollision->setToolTip(QString("Collision mode ").append((st.is_mode()) ? "on" : "off"));
@@ -113,31 +149,66 @@ void main_window::collision_slot() {
 }
 
 void main_window::delete_slot() {
-    size_t n = st.number_for_deleting();
+    size_t n = results.number_for_deleting();
     if (n == 0) {
         short_dialog(QString("No files for deleting"));
         return;
     }
-    auto res = long_dialog("Deleting files!", QString("Do you really want to delete %1 ").arg(n).append((n == 1) ? "file" : "files").append("?"));
-    if (res == QMessageBox::Ok) {
-        QTreeWidgetItemIterator it(ui->treeWidget);
-        size_t deleted = st.delete_files(it, [](const QTreeWidgetItem &item){return item.text(1);}, [](const QTreeWidgetItem &item){return item.text(3);});
-        if (deleted == 1) {
-            console_slot("file was deleted", false, "red");
-            short_dialog(QString("%1 file was deleted").arg(deleted));
-        } else {
-            console_slot("files were deleted", false, "red");
-            short_dialog(QString("%1 files were deleted").arg(deleted));
-        }
-        again_slot();
+    QMessageBox message_box;
+    message_box.setText("Reclaiming space!");
+    message_box.setInformativeText(QString("What should happen to %1 ").arg(n).append((n == 1) ? "file" : "files")
+                                   .append("? Files changed since the scan are left alone."));
+    message_box.setIcon(QMessageBox::Information);
+    QPushButton *remove = message_box.addButton("Delete", QMessageBox::DestructiveRole);
+    QPushButton *hardlink = message_box.addButton("Replace with hardlinks", QMessageBox::AcceptRole);
+    QPushButton *reflink = message_box.addButton("Replace with reflinks", QMessageBox::AcceptRole);
+    message_box.addButton(QMessageBox::Cancel);
+    message_box.exec();
+    reclaimer::action act;
+    if (message_box.clickedButton() == remove) {
+        act = reclaimer::DELETE;
+    } else if (message_box.clickedButton() == hardlink) {
+        act = reclaimer::HARDLINK;
+    } else if (message_box.clickedButton() == reflink) {
+        act = reclaimer::REFLINK;
+    } else {
+        return;
+    }
+    /* the work runs on the reclaimer threads, the window keeps drawing the console meanwhile
+     * and only Cancel stays enabled */
+    reclaiming = true;
+    setItemsEnabled(false, ui->actionAgain, ui->actionDelete, ui->actionExit);
+    setItemsEnabled(true, ui->actionCancel);
+    ui->resultView->setEnabled(false);
+    ui->filterEdit->setEnabled(false);
+    auto result = results.result();
+    auto plan = results.plan_for_deleting();
+    auto done = std::async(std::launch::async, [this, &result, &plan, act]() { return st.reclaim(*result, plan, act); });
+    while (done.wait_for(std::chrono::milliseconds(PROGRESS_PERIOD)) != std::future_status::ready) {
+        QCoreApplication::processEvents();
     }
+    reclaimer::report rep = done.get();
+    reclaiming = false;
+    setItemsEnabled(true, ui->actionAgain, ui->actionDelete, ui->actionExit);
+    setItemsEnabled(false, ui->actionCancel);
+    ui->resultView->setEnabled(true);
+    ui->filterEdit->setEnabled(true);
+    QString text = QString("%1 of %2 files handled, %3 KiB freed").arg(rep.done).arg(n).arg(rep.bytes / 1024);
+    if (rep.changed > 0) text.append(QString(", %1 changed since the scan").arg(rep.changed));
+    if (rep.failed > 0) text.append(QString(", %1 failed").arg(rep.failed));
+    if (rep.left > 0) text.append(QString(", stopped before %1 more").arg(rep.left));
+    short_dialog(text);
+    again_slot();
 }
 
 void main_window::exit_slot() {
     if (st.is_scanning() || st.is_paused()) {
-        auto res = long_dialog("Exit", "Do you really want to exit? Files are still scanning");
+        auto res = long_dialog("Exit", "Do you really want to exit? Files are still scanning, the scan can be resumed on the next start");
         if (res == QMessageBox::Ok) {
-            thread->exit();
+            /* pausing saves a checkpoint, wait for it before leaving */
+            st.pause();
+            thread->quit();
+            thread->wait();
             QWidget::close();
         }
     } else {
@@ -159,36 +230,60 @@ void main_window::refresh_slot() {
     st.open_directory();
 }
 
+void main_window::resume_slot() {
+    setItemsVisible(false, ui->actionResume);
+    if (!st.resume_checkpoint()) return;
+    ui->actionCollision->setToolTip(QString("Collision mode ").append((st.is_mode()) ? "off" : "on"));
+    thread->start();
+    ui->treeWidget->clear();
+}
+
 void main_window::scan_slot() {
+    setItemsVisible(false, ui->actionResume);
     thread->start();
     ui->treeWidget->clear();
 }
 
-void main_window::select_slot(QTreeWidgetItem *item, int column) {
-    st.select_item(item, [](const QTreeWidgetItem &item){return item.text(1);}, [](QTreeWidgetItem &item, QString value){return item.setText(1, value);});
+void main_window::select_slot(const QModelIndex &index) {
+    results.toggle(index);
+}
+
+void main_window::watch_slot(bool checked) {
+    st.set_watching(checked);
+    console_slot(QString("watching for changes ").append((checked) ? "on" : "off"), true, "purple");
+}
+
+void main_window::similar_slot(bool checked) {
+    st.set_similar((checked) ? SIMILAR_RATIO : 0);
+    console_slot(QString("finding similar files ").append((checked) ? "on" : "off"), true, "purple");
 }
 
 void main_window::started_slot() {
     setText(ui->actionScan, "Resume");
     setItemsEnabled(true, ui->actionPause, ui->actionCancel);
-    setItemsEnabled(false, ui->actionChoose, ui->actionRefresh, ui->actionScan, ui->actionCollision);
+    setItemsEnabled(false, ui->actionChoose, ui->actionAddRoot, ui->actionRefresh, ui->actionScan, ui->actionCollision, ui->actionSimilar, ui->actionClearCache);
     ui->treeWidget->setDisabled(true);
+    progress_timer.start(PROGRESS_PERIOD);
 }
 void main_window::paused_slot() {
+    progress_timer.stop();
     setItemsEnabled(true, ui->actionScan, ui->actionCancel);
     setItemsEnabled(false, ui->actionPause);
 }
 void main_window::finished_slot() {
+    progress_timer.stop();
     thread->exit();
     setText(ui->actionScan, "Scan");
     setItemsEnabled(false, ui->actionScan, ui->actionPause, ui->actionCancel);
     setItemsVisible(true, ui->actionAgain, ui->actionDelete);
-
-    disconnect(ui->treeWidget, &QTreeWidget::itemActivated, this, &main_window::open_slot);
-    connect(ui->treeWidget, &QTreeWidget::itemActivated, this, &main_window::select_slot);
     ui->treeWidget->setEnabled(true);
 }
 
+void main_window::progress_slot() {
+    /* the scanner only updates counters, the line is formatted here at a fixed rate */
+    if (st.is_scanning()) console_slot(st.progress_text(), false);
+}
+
 void main_window::error(QString &text) {
     QMessageBox messageBox;
     messageBox.critical(nullptr, "Error", text);
@@ -204,7 +299,7 @@ void main_window::console_slot(QString text, bool save, QString color) {
     ui->label->setText(cs.get_text());
 }
 
-void main_window::add_item(QString s1, QString s2, QString s3, QString s4, QString s5, QBrush *brush) {
+void main_window::add_item(QString s1, QString s2, QString s3, QString s4, QString s5, bool marked) {
     QTreeWidgetItem *item = new QTreeWidgetItem(ui->treeWidget);
     item->setText(0, s1);
     item->setText(1, s2);
@@ -212,7 +307,7 @@ void main_window::add_item(QString s1, QString s2, QString s3, QString s4, QStri
     item->setText(3, s4);
     item->setText(4, s5);
     ui->treeWidget->addTopLevelItem(item);
-    if (brush != nullptr) color_item(item, brush);
+    if (marked) color_item(item, &red_brush);
 }
 
 void main_window::color_item(QTreeWidgetItem *item, QBrush *brush) {
@@ -221,6 +316,24 @@ void main_window::color_item(QTreeWidgetItem *item, QBrush *brush) {
     }
 }
 
+void main_window::results_slot(std::shared_ptr<const scan_result> result) {
+    ui->filterEdit->clear();
+    results.set_result(std::move(result));
+    show_results(true);
+}
+
+void main_window::changed_slot(std::shared_ptr<const scan_result> result) {
+    /* the filter stays, marks are made again from the new groups; late updates after "scan again" are dropped */
+    if (!ui->actionAgain->isVisible()) return;
+    results.set_result(std::move(result));
+}
+
+void main_window::show_results(bool f) {
+    ui->treeWidget->setVisible(!f);
+    ui->resultView->setVisible(f);
+    ui->filterEdit->setVisible(f);
+}
+
 void main_window::clear_items() {
     ui->treeWidget->clear();
     QCoreApplication::processEvents();
@@ -2,15 +2,23 @@
 #define MAINWINDOW_H
 
 #include "scantools.h"
+#include "resultmodel.h"
 
 #include <QMainWindow>
 #include <QThread>
+#include <QTimer>
 #include <QTreeWidgetItem>
 #include <QBrush>
+#include <QColor>
 #include <QAction>
 #include <memory>
 #include <queue>
 
+static QColor red = QColor(255, 0, 0);
+static QColor black = QColor(0, 0, 0);
+static QBrush red_brush = QBrush(red);
+static QBrush black_brush = QBrush(black);
+
 namespace Ui {
     class MainWindow;
 }
@@ -54,17 +62,22 @@ class main_window : public QMainWindow {
 private slots:
     /* slots from ui signals */
     void about_slot();
+    void add_root_slot();
     void again_slot();
     void cancel_slot();
     void choose_slot();
+    void clear_cache_slot();
     void collision_slot();
     void delete_slot();
     void exit_slot();
     void open_slot(QTreeWidgetItem *item, int column);
     void pause_slot();
     void refresh_slot();
+    void resume_slot();
     void scan_slot();
-    void select_slot(QTreeWidgetItem *item, int column);
+    void select_slot(const QModelIndex &index);
+    void watch_slot(bool checked);
+    void similar_slot(bool checked);
 
     void error(QString &text);
 
@@ -73,18 +86,25 @@ private slots:
     void paused_slot();
     void finished_slot();
     void console_slot(QString text, bool save, QString color = "");
-    void add_item(QString s1 = "", QString s2 = "", QString s3 = "", QString s4 = "", QString s5 = "", QBrush *brush = nullptr);
+    void add_item(QString s1 = "", QString s2 = "", QString s3 = "", QString s4 = "", QString s5 = "", bool marked = false);
     void color_item(QTreeWidgetItem *item, QBrush *brush);
     void clear_items();
     void update_items();
+    void results_slot(std::shared_ptr<const scan_result> result);
+    void changed_slot(std::shared_ptr<const scan_result> result);
+    void progress_slot();
 
 private:
     QThread *thread;
+    QTimer progress_timer;
     std::unique_ptr<Ui::MainWindow> ui;
     scantools st;
+    result_model results;
     console cs;
     bool scanning = false;
+    bool reclaiming = false;
 
+    void show_results(bool f);
     int short_dialog(QString const &text);
     int long_dialog(QString const &text, QString const &information);
 
@@ -0,0 +1,253 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+std::atomic<bool> profiler::on(false);
+
+namespace {
+
+struct shared_state {
+    std::mutex lock;
+    int64_t origin = 0;
+    uint32_t scan_tid = 0;
+    std::vector<profiler::stage_record> stages;
+    std::vector<profiler::thread_record> threads;
+    std::vector<profiler::outlier> directories, files;
+    int64_t stage_cpu = 0;              // process CPU time when the open stage began
+};
+
+shared_state &shared() {
+    static shared_state s;
+    return s;
+}
+
+int64_t thread_cpu() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t process_cpu() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+/* keeps the n largest by key, smallest last */
+template<class Key>
+void keep_top(std::vector<profiler::outlier> &top, const profiler::outlier &o, Key key) {
+    if (top.size() == profiler::OUTLIERS && key(top.back()) >= key(o)) return;
+    auto at = std::find_if(top.begin(), top.end(), [&](const profiler::outlier &t) { return key(t) < key(o); });
+    top.insert(at, o);
+    if (top.size() > profiler::OUTLIERS) top.pop_back();
+}
+
+int64_t by_duration(const profiler::outlier &o) { return o.duration; }
+int64_t by_bytes(const profiler::outlier &o) { return static_cast<int64_t>(o.bytes); }
+
+/* what one thread counted since it joined the current stage */
+struct thread_block {
+    bool used = false;
+    uint32_t tid = 0;
+    size_t stage = 0;
+    int64_t start = 0, cpu = 0;
+    uint64_t bytes = 0, items = 0, syscalls = 0;
+    std::vector<profiler::outlier> directories, files;
+
+    void touch() {
+        if (used) return;
+        used = true;
+        tid = static_cast<uint32_t>(syscall(SYS_gettid));
+        start = profiler::now();
+        cpu = thread_cpu();
+        std::lock_guard<std::mutex> lg(shared().lock);
+        stage = shared().stages.size() - 1;
+    }
+    void flush() {
+        if (!used) return;
+        profiler::thread_record r;
+        r.tid = tid;
+        r.stage = stage;
+        r.start = start;
+        r.end = profiler::now();
+        r.cpu = thread_cpu() - cpu;
+        r.bytes = bytes;
+        r.items = items;
+        r.syscalls = syscalls;
+        {
+            shared_state &s = shared();
+            std::lock_guard<std::mutex> lg(s.lock);
+            s.threads.push_back(r);
+            for (auto &d : directories) keep_top(s.directories, d, by_duration);
+            for (auto &f : files) keep_top(s.files, f, by_bytes);
+        }
+        *this = thread_block();
+    }
+    ~thread_block() { flush(); }
+};
+
+thread_local thread_block block;
+
+std::string json_escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+}
+
+void profiler::enable(bool enabled) {
+    on = enabled;
+}
+
+int64_t profiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+            - shared().origin;
+}
+
+void profiler::clear() {
+    shared_state &s = shared();
+    std::lock_guard<std::mutex> lg(s.lock);
+    s.origin = 0;
+    s.origin = now();
+    s.scan_tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    s.stages.clear();
+    s.threads.clear();
+    s.directories.clear();
+    s.files.clear();
+}
+
+void profiler::begin_stage(const char *name) {
+    if (!enabled()) return;
+    shared_state &s = shared();
+    {
+        std::lock_guard<std::mutex> lg(s.lock);
+        stage_record r;
+        r.name = name;
+        r.start = now();
+        r.end = r.cpu = 0;
+        r.bytes = r.items = r.syscalls = 0;
+        s.stages.push_back(r);
+        s.stage_cpu = process_cpu();
+    }
+    block.touch();
+}
+
+void profiler::end_stage(uint64_t items) {
+    if (!enabled()) return;
+    block.flush();
+    shared_state &s = shared();
+    std::lock_guard<std::mutex> lg(s.lock);
+    if (s.stages.empty()) return;
+    /* workers of the stage are joined by now, their blocks were flushed on exit */
+    stage_record &r = s.stages.back();
+    size_t stage = s.stages.size() - 1;
+    r.end = now();
+    r.cpu = process_cpu() - s.stage_cpu;
+    r.items = items;
+    for (auto &t : s.threads) {
+        if (t.stage != stage) continue;
+        r.bytes += t.bytes;
+        r.syscalls += t.syscalls;
+    }
+}
+
+void profiler::count(uint64_t syscalls, uint64_t bytes, uint64_t items) {
+    block.touch();
+    block.syscalls += syscalls;
+    block.bytes += bytes;
+    block.items += items;
+}
+
+void profiler::directory(const std::string &path, int64_t start, int64_t duration) {
+    block.touch();
+    if (block.directories.size() == OUTLIERS && block.directories.back().duration >= duration) return;
+    keep_top(block.directories, outlier{path, start, duration, 0, block.tid}, by_duration);
+}
+
+void profiler::hashed_file(const std::string &path, int64_t start, int64_t duration, uint64_t bytes) {
+    block.touch();
+    if (block.files.size() == OUTLIERS && block.files.back().bytes >= bytes) return;
+    keep_top(block.files, outlier{path, start, duration, bytes, block.tid}, by_bytes);
+}
+
+bool profiler::write_trace(const std::string &path) {
+    shared_state &s = shared();
+    std::lock_guard<std::mutex> lg(s.lock);
+    FILE *out = fopen(path.c_str(), "w");
+    if (out == nullptr) return false;
+    /* Chrome trace event format, complete events with microsecond timestamps */
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"scan\"}}", s.scan_tid);
+    auto event = [out](const char *category, const std::string &name, uint32_t tid, const totals &t) {
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                     "\"args\":{\"cpu_ms\":%.3f,\"bytes\":%llu,\"items\":%llu,\"syscalls\":%llu}}",
+                json_escape(name).c_str(), category, tid, t.start / 1e3, (t.end - t.start) / 1e3, t.cpu / 1e6,
+                static_cast<unsigned long long>(t.bytes), static_cast<unsigned long long>(t.items),
+                static_cast<unsigned long long>(t.syscalls));
+    };
+    for (auto &r : s.stages) event("stage", r.name, s.scan_tid, r);
+    for (auto &t : s.threads) {
+        if (t.tid == s.scan_tid || t.stage >= s.stages.size()) continue;
+        event("worker", s.stages[t.stage].name, t.tid, t);
+    }
+    auto outliers = [out](const char *name, const std::vector<outlier> &list) {
+        for (auto &o : list) {
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"outlier\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"args\":{\"path\":\"%s\",\"bytes\":%llu}}",
+                    name, o.tid, o.start / 1e3, o.duration / 1e3, json_escape(o.path).c_str(),
+                    static_cast<unsigned long long>(o.bytes));
+        }
+    };
+    outliers("slow directory", s.directories);
+    outliers("large file", s.files);
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+}
+
+std::string profiler::summary() {
+    shared_state &s = shared();
+    std::lock_guard<std::mutex> lg(s.lock);
+    std::string text;
+    char line[512];
+    snprintf(line, sizeof(line), "%-22s %10s %10s %10s %12s %10s %8s\n", "stage", "wall ms", "cpu ms", "MiB", "items", "syscalls", "threads");
+    text += line;
+    for (size_t k = 0; k < s.stages.size(); k++) {
+        auto &r = s.stages[k];
+        size_t threads = std::count_if(s.threads.begin(), s.threads.end(), [k](const thread_record &t) { return t.stage == k; });
+        snprintf(line, sizeof(line), "%-22s %10.1f %10.1f %10.1f %12llu %10llu %8zu\n", r.name.c_str(),
+                 (r.end - r.start) / 1e6, r.cpu / 1e6, r.bytes / (1024.0 * 1024), static_cast<unsigned long long>(r.items),
+                 static_cast<unsigned long long>(r.syscalls), threads);
+        text += line;
+    }
+    if (!s.directories.empty()) text += "slowest directories:\n";
+    for (auto &o : s.directories) {
+        snprintf(line, sizeof(line), "  %10.1f ms  ", o.duration / 1e6);
+        text += line + o.path + "\n";
+    }
+    if (!s.files.empty()) text += "largest hashed files:\n";
+    for (auto &o : s.files) {
+        snprintf(line, sizeof(line), "  %10.1f MiB %8.1f ms  ", o.bytes / (1024.0 * 1024), o.duration / 1e6);
+        text += line + o.path + "\n";
+    }
+    return text;
+}
@@ -0,0 +1,57 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+/* scan profiling with little overhead: every thread counts into its own block, which is
+ * merged once, when the thread ends or its stage closes; besides per-stage and per-thread
+ * totals only the few slowest directories and largest hashed files are kept */
+class profiler {
+public:
+    static const size_t OUTLIERS = 10;
+
+    struct outlier {
+        std::string path;
+        int64_t start, duration;        // nanoseconds
+        uint64_t bytes;
+        uint32_t tid;
+    };
+    struct totals {
+        int64_t start, end;             // wall clock, nanoseconds since the scan started
+        int64_t cpu;                    // nanoseconds of CPU time
+        uint64_t bytes, items, syscalls;
+    };
+    struct thread_record : totals {
+        uint32_t tid;
+        size_t stage;
+    };
+    struct stage_record : totals {
+        std::string name;
+    };
+
+private:
+    static std::atomic<bool> on;
+
+public:
+    static void enable(bool enabled);
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+    static int64_t now();
+    static void clear();
+
+    /* called by the scanning thread around each stage */
+    static void begin_stage(const char *name);
+    static void end_stage(uint64_t items);
+
+    /* called from any thread, only while enabled */
+    static void count(uint64_t syscalls, uint64_t bytes = 0, uint64_t items = 0);
+    static void directory(const std::string &path, int64_t start, int64_t duration);
+    static void hashed_file(const std::string &path, int64_t start, int64_t duration, uint64_t bytes);
+
+    static bool write_trace(const std::string &path);
+    static std::string summary();
+};
+
+#endif // PROFILER_H
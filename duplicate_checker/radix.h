@@ -0,0 +1,87 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include "hasher.h"
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+const size_t RADIX_BITS = 16;
+const size_t RADIX = size_t(1) << RADIX_BITS;
+const size_t RADIX_MIN = 1024; // shorter ranges are left to std::sort
+
+/* LSD radix sort of ids by a 64-bit key, 16 bits a pass; the keys are read once and move
+ * along with the ids, so no pass gathers from the table, and a pass whose digit is the same
+ * for every key is skipped: sizes below 4 GiB take two passes; stop() is asked between
+ * passes, false if it stopped, the ids are then in no particular order */
+template<class Key, class Stop>
+bool radix_sort(uint32_t *ids, size_t n, Key key, Stop stop) {
+    const size_t PASSES = 64 / RADIX_BITS;
+    if (n < RADIX_MIN) {
+        std::sort(ids, ids + n, [&key](uint32_t f1, uint32_t f2) { return key(f1) < key(f2); });
+        return true;
+    }
+    std::vector<uint64_t> keys(n), keys_to(n);
+    std::vector<uint32_t> ids_to(n);
+    std::vector<size_t> counts(PASSES * RADIX, 0);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = key(ids[i]);
+        for (size_t p = 0; p < PASSES; p++) counts[p * RADIX + (keys[i] >> (p * RADIX_BITS) & (RADIX - 1))]++;
+    }
+    uint32_t *from = ids, *to = ids_to.data();
+    uint64_t *kfrom = keys.data(), *kto = keys_to.data();
+    for (size_t p = 0; p < PASSES && n > 0; p++) {
+        size_t *c = &counts[p * RADIX];
+        size_t shift = p * RADIX_BITS;
+        if (c[kfrom[0] >> shift & (RADIX - 1)] == n) continue;
+        if (stop()) {
+            if (from != ids) std::copy(from, from + n, ids);
+            return false;
+        }
+        for (size_t d = 0, sum = 0; d < RADIX; d++) {
+            size_t k = c[d];
+            c[d] = sum;
+            sum += k;
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t at = c[kfrom[i] >> shift & (RADIX - 1)]++;
+            to[at] = from[i];
+            kto[at] = kfrom[i];
+        }
+        std::swap(from, to);
+        std::swap(kfrom, kto);
+    }
+    if (from != ids) std::copy(from, from + n, ids);
+    return true;
+}
+
+/* the first eight bytes of a digest, big-endian, so keys order like the digests */
+inline uint64_t digest_prefix(const digest &d) {
+    uint64_t k = 0;
+    for (size_t b = 0; b < 8; b++) k = k << 8 | d[b];
+    return k;
+}
+
+/* ids ordered by their digests: radix on the prefix, then the rare runs of a shared
+ * prefix, mostly zero digests of skipped files, are sorted on the whole digest */
+template<class Stop>
+bool sort_by_digest(uint32_t *ids, size_t n, const std::vector<digest> &hash, Stop stop) {
+    auto less = [&hash](uint32_t f1, uint32_t f2) { return hash[f1] < hash[f2]; };
+    if (n < RADIX_MIN) {
+        std::sort(ids, ids + n, less);
+        return true;
+    }
+    if (!radix_sort(ids, n, [&hash](uint32_t f) { return digest_prefix(hash[f]); }, stop)) return false;
+    for (size_t b = 0, e; b < n; b = e) {
+        uint64_t k = digest_prefix(hash[ids[b]]);
+        e = b + 1;
+        while (e < n && digest_prefix(hash[ids[e]]) == k) e++;
+        if (e - b > 1) std::sort(ids + b, ids + e, less);
+    }
+    return true;
+}
+
+#endif // RADIX_H
@@ -0,0 +1,482 @@
+#include "readengine.h"
+#include "hashpool.h"
+#include "profiler.h"
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+const size_t READ_BLOCK = 1024 * 1024;
+
+/* aligned, so O_DIRECT reads can land in it */
+struct read_buffer {
+    char *data;
+
+    read_buffer() : data(static_cast<char *>(aligned_alloc(io_governor::ALIGNMENT, READ_BLOCK))) {}
+    ~read_buffer() { free(data); }
+};
+
+/* hashes length bytes from offset, or the whole file if length < 0;
+ * gives up between blocks once stop() says so */
+template <typename Stop>
+static bool read_range(const read_job &job, Stop stop, io_governor &governor, std::atomic<uint64_t> *bytes, bool &stopped) {
+    thread_local read_buffer buffer;
+    bool profiling = profiler::enabled();
+    int64_t started = (profiling) ? profiler::now() : 0;
+    uint64_t calls = 2, loaded = 0; // open and close
+    bool direct;
+    int fd = governor.open(job.path, direct);
+    if (fd < 0 || buffer.data == nullptr) {
+        if (fd >= 0) close(fd);
+        if (profiling) profiler::count(1);
+        return false;
+    }
+    bool ok = true;
+    /* O_DIRECT reads start and end at aligned offsets, the bytes around the range are not hashed */
+    int64_t offset = (direct) ? io_governor::align_down(job.offset) : job.offset;
+    size_t skip = static_cast<size_t>(job.offset - offset);
+    int64_t left = (job.length < 0) ? std::numeric_limits<int64_t>::max() : job.length;
+    io_governor::window window;
+    while (left > 0) {
+        if (stop()) {
+            stopped = true;
+            break;
+        }
+        size_t want = (left > static_cast<int64_t>(READ_BLOCK - skip)) ? READ_BLOCK : skip + left;
+        if (direct) want = io_governor::align_up(want);
+        governor.before(fd, direct, offset, want, window);
+        ssize_t n = pread(fd, buffer.data, want, offset);
+        calls++;
+        if (n < 0) ok = false;
+        if (n <= 0) break;
+        governor.after(fd, direct, offset, n, window);
+        loaded += n;
+        offset += n;
+        if (static_cast<size_t>(n) <= skip) break;
+        size_t used = static_cast<size_t>(std::min<int64_t>(n - skip, left));
+        job.hash->add(buffer.data + skip, used);
+        if (bytes != nullptr) *bytes += used;
+        left -= used;
+        skip = 0;
+        if (static_cast<size_t>(n) < want) break; // end of file
+    }
+    close(fd);
+    if (profiling) {
+        profiler::count(calls, loaded, 1);
+        profiler::hashed_file(job.path, started, profiler::now() - started, loaded);
+    }
+    return ok && (job.length < 0 || left == 0);
+}
+
+/* one file at a time per thread, read with blocking pread */
+class pread_engine : public read_engine {
+private:
+    hash_pool pool;
+    io_governor &governor;
+    std::atomic<uint64_t> *bytes;
+    std::atomic<uint64_t> epoch;
+
+public:
+    pread_engine(size_t threads, size_t depth, io_governor &governor, std::atomic<uint64_t> *bytes)
+        : pool(threads, depth), governor(governor), bytes(bytes), epoch(0) {}
+
+    bool push(read_job &&job, std::chrono::milliseconds timeout) override {
+        if (pool.is_canceled()) return false;
+        /* std::function needs a copyable job */
+        auto shared = std::make_shared<read_job>(std::move(job));
+        uint64_t e = epoch;
+        bool pushed = pool.push([this, shared, e]() {
+            bool stopped = false;
+            bool ok = read_range(*shared, [this, e]() { return epoch != e || pool.is_canceled(); }, governor, bytes, stopped);
+            if (!stopped) shared->done(ok, *shared->hash);
+        }, timeout);
+        if (!pushed) job = std::move(*shared);
+        return pushed;
+    }
+    bool wait(std::chrono::milliseconds timeout) override { return pool.wait(timeout); }
+    void discard() override {
+        epoch++;
+        governor.wake();
+        pool.discard();
+    }
+    void cancel() override {
+        pool.cancel();
+        governor.wake();
+    }
+    const char *name() const override { return "pread"; }
+};
+
+#ifdef HAVE_IO_URING
+
+const size_t URING_SLOTS = 16;          // files in flight per ring
+const size_t URING_CHUNK = 128 * 1024;  // one read, one registered buffer per slot
+const size_t ALIGNMENT = 4096;
+
+static int uring_setup(unsigned entries, io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, complete, flags, nullptr, 0));
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+/* every worker thread owns a ring and keeps one read in flight for each of its files,
+ * so a file is still hashed in order while many files are read at once;
+ * the data lands in buffers registered with the kernel and is hashed where it lands */
+class uring_engine : public read_engine {
+private:
+    struct slot {
+        read_job job;
+        int fd = -1;
+        int64_t offset = 0, left = 0;
+        int64_t started = 0;
+        uint64_t loaded = 0;
+        uint64_t epoch = 0;
+        bool busy = false, opened = false, direct = false;
+        size_t skip = 0, want = 0;
+        io_governor::window window;
+        char *buffer = nullptr;
+    };
+    struct ring {
+        int fd = -1;
+        void *sq_map = nullptr, *cq_map = nullptr;
+        size_t sq_length = 0, cq_length = 0;
+        io_uring_sqe *sqes = nullptr;
+        size_t sqes_length = 0;
+        unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+        unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+        io_uring_cqe *cqes = nullptr;
+        unsigned queued = 0;
+        bool fixed = false;
+        char *buffers = nullptr;
+        std::vector<slot> slots;
+
+        bool setup();
+        ~ring();
+        void read(size_t s);
+    };
+
+    std::vector<std::unique_ptr<ring>> rings;
+    std::vector<std::thread> workers;
+    std::deque<read_job> jobs;
+    size_t depth;
+    size_t per_ring;                    // files read at once per ring
+    size_t busy;
+    bool closing;
+    std::atomic<bool> canceled;
+    std::atomic<uint64_t> epoch;
+    io_governor &governor;
+    std::atomic<uint64_t> *bytes;
+    std::mutex lock;
+    std::condition_variable has_job, has_room, idle;
+
+    void run(ring &r);
+    void submit(ring &r, size_t s);
+    void finish(ring &r, size_t s, bool ok, bool drop);
+    bool stopped(const slot &sl) const { return canceled || epoch != sl.epoch; }
+
+public:
+    uring_engine(size_t depth, size_t inflight, io_governor &governor, std::atomic<uint64_t> *bytes);
+    ~uring_engine() override;
+    bool start(size_t threads);
+
+    bool push(read_job &&job, std::chrono::milliseconds timeout) override;
+    bool wait(std::chrono::milliseconds timeout) override;
+    void discard() override;
+    void cancel() override;
+    const char *name() const override { return "io_uring"; }
+};
+
+bool uring_engine::ring::setup() {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = uring_setup(URING_SLOTS, &p);
+    if (fd < 0) return false;
+    sq_length = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_length = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_length = cq_length = std::max(sq_length, cq_length);
+    sq_map = mmap(nullptr, sq_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        sq_map = nullptr;
+        return false;
+    }
+    if (single) {
+        cq_map = sq_map;
+    } else {
+        cq_map = mmap(nullptr, cq_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) {
+            cq_map = nullptr;
+            return false;
+        }
+    }
+    sqes_length = p.sq_entries * sizeof(io_uring_sqe);
+    void *s = mmap(nullptr, sqes_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) return false;
+    sqes = static_cast<io_uring_sqe *>(s);
+    char *sq = static_cast<char *>(sq_map), *cq = static_cast<char *>(cq_map);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    buffers = static_cast<char *>(aligned_alloc(ALIGNMENT, URING_SLOTS * URING_CHUNK));
+    if (buffers == nullptr) return false;
+    slots.resize(URING_SLOTS);
+    std::vector<iovec> iov(URING_SLOTS);
+    for (size_t k = 0; k < URING_SLOTS; k++) {
+        slots[k].buffer = buffers + k * URING_CHUNK;
+        iov[k].iov_base = slots[k].buffer;
+        iov[k].iov_len = URING_CHUNK;
+    }
+    /* pinned buffers count against RLIMIT_MEMLOCK on older kernels, plain reads do without */
+    fixed = uring_register(fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == 0;
+    return true;
+}
+
+uring_engine::ring::~ring() {
+    for (auto &s : slots) {
+        if (s.fd >= 0) close(s.fd);
+    }
+    if (sqes != nullptr) munmap(sqes, sqes_length);
+    if (cq_map != nullptr && cq_map != sq_map) munmap(cq_map, cq_length);
+    if (sq_map != nullptr) munmap(sq_map, sq_length);
+    if (fd >= 0) close(fd);
+    free(buffers);
+}
+
+void uring_engine::ring::read(size_t s) {
+    slot &sl = slots[s];
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (fixed) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = sl.fd;
+    sqe->off = sl.offset;
+    sqe->addr = reinterpret_cast<uint64_t>(sl.buffer);
+    sqe->len = static_cast<unsigned>(sl.want);
+    if (fixed) sqe->buf_index = static_cast<uint16_t>(s);
+    sqe->user_data = s;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+}
+
+uring_engine::uring_engine(size_t depth, size_t inflight, io_governor &governor, std::atomic<uint64_t> *bytes)
+    : depth(depth), per_ring((inflight > 0) ? std::min(inflight, URING_SLOTS) : URING_SLOTS), busy(0), closing(false), canceled(false), epoch(0), governor(governor), bytes(bytes) {}
+
+bool uring_engine::start(size_t threads) {
+    if (threads == 0) threads = 1;
+    if (depth == 0) depth = threads * URING_SLOTS;
+    for (size_t i = 0; i < threads; i++) {
+        rings.emplace_back(new ring());
+        if (!rings.back()->setup()) return false;
+    }
+    for (auto &r : rings) {
+        workers.emplace_back(&uring_engine::run, this, std::ref(*r));
+    }
+    return true;
+}
+
+uring_engine::~uring_engine() {
+    {
+        std::lock_guard<std::mutex> lg(lock);
+        closing = true;
+    }
+    has_job.notify_all();
+    for (auto &t : workers) t.join();
+}
+
+void uring_engine::finish(ring &r, size_t s, bool ok, bool drop) {
+    slot &sl = r.slots[s];
+    if (sl.fd >= 0) close(sl.fd);
+    if (profiler::enabled()) {
+        profiler::count(sl.opened ? 2 : 1, sl.loaded, 1);
+        if (sl.opened) profiler::hashed_file(sl.job.path, sl.started, profiler::now() - sl.started, sl.loaded);
+    }
+    if (!drop) sl.job.done(ok, *sl.job.hash);
+    sl.job = read_job();
+    sl.fd = -1;
+    sl.busy = false;
+    std::lock_guard<std::mutex> lg(lock);
+    busy--;
+    if (busy == 0 && jobs.empty()) idle.notify_all();
+}
+
+void uring_engine::submit(ring &r, size_t s) {
+    slot &sl = r.slots[s];
+    size_t want = (sl.left > static_cast<int64_t>(URING_CHUNK - sl.skip)) ? URING_CHUNK : sl.skip + sl.left;
+    if (sl.direct) want = io_governor::align_up(want);
+    governor.before(sl.fd, sl.direct, sl.offset, want, sl.window);
+    sl.want = want;
+    r.read(s);
+}
+
+void uring_engine::run(ring &r) {
+    size_t active = 0, inflight = 0;
+    std::vector<size_t> taken;
+    while (true) {
+        taken.clear();
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            if (active == 0) {
+                has_job.wait(lk, [this] { return closing || !jobs.empty(); });
+                if (jobs.empty()) return;
+            }
+            for (size_t s = 0; s < r.slots.size() && active < per_ring && !jobs.empty(); s++) {
+                if (r.slots[s].busy) continue;
+                r.slots[s].job = std::move(jobs.front());
+                r.slots[s].busy = true;
+                r.slots[s].epoch = epoch;
+                jobs.pop_front();
+                taken.push_back(s);
+                busy++;
+                active++;
+            }
+            if (!taken.empty()) has_room.notify_all();
+        }
+        bool profiling = profiler::enabled();
+        for (size_t s : taken) {
+            slot &sl = r.slots[s];
+            sl.started = (profiling) ? profiler::now() : 0;
+            sl.loaded = 0;
+            sl.left = (sl.job.length < 0) ? std::numeric_limits<int64_t>::max() : sl.job.length;
+            sl.fd = governor.open(sl.job.path, sl.direct);
+            sl.opened = sl.fd >= 0;
+            sl.offset = (sl.direct) ? io_governor::align_down(sl.job.offset) : sl.job.offset;
+            sl.skip = static_cast<size_t>(sl.job.offset - sl.offset);
+            if (!sl.opened) {
+                active--;
+                finish(r, s, false, stopped(sl));
+            } else if (sl.left == 0) {
+                active--;
+                finish(r, s, true, stopped(sl));
+            } else {
+                submit(r, s);
+                inflight++;
+            }
+        }
+        if (inflight == 0) continue;
+
+        int n = uring_enter(r.fd, r.queued, 1, IORING_ENTER_GETEVENTS);
+        if (profiling) profiler::count(1);
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            /* the ring is unusable, let the files fail rather than hang */
+            for (size_t s = 0; s < r.slots.size(); s++) {
+                if (!r.slots[s].busy) continue;
+                active--;
+                finish(r, s, false, stopped(r.slots[s]));
+            }
+            r.queued = 0;
+            inflight = 0;
+            continue;
+        }
+        if (n > 0) r.queued -= std::min<unsigned>(r.queued, n);
+
+        unsigned head = *r.cq_head;
+        unsigned tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            io_uring_cqe &cqe = r.cqes[head & *r.cq_mask];
+            size_t s = static_cast<size_t>(cqe.user_data);
+            int res = cqe.res;
+            slot &sl = r.slots[s];
+            inflight--;
+            bool stop = stopped(sl), more = false;
+            if (res > 0) {
+                governor.after(sl.fd, sl.direct, sl.offset, res, sl.window);
+                sl.loaded += res;
+                sl.offset += res;
+            }
+            if (res > 0 && static_cast<size_t>(res) > sl.skip && !stop) {
+                size_t used = static_cast<size_t>(std::min<int64_t>(res - sl.skip, sl.left));
+                sl.job.hash->add(sl.buffer + sl.skip, used);
+                if (bytes != nullptr) *bytes += used;
+                sl.left -= used;
+                sl.skip = 0;
+                /* a short read is the end of the file */
+                more = sl.left > 0 && static_cast<size_t>(res) == sl.want;
+            }
+            if (more) {
+                submit(r, s);
+                inflight++;
+            } else {
+                active--;
+                finish(r, s, res >= 0 && (sl.job.length < 0 || sl.left == 0), stop);
+            }
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+bool uring_engine::push(read_job &&job, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lk(lock);
+    if (canceled) return false;
+    if (!has_room.wait_for(lk, timeout, [this] { return jobs.size() < depth; })) return false;
+    jobs.push_back(std::move(job));
+    has_job.notify_one();
+    return true;
+}
+
+bool uring_engine::wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lk(lock);
+    return idle.wait_for(lk, timeout, [this] { return busy == 0 && jobs.empty(); });
+}
+
+void uring_engine::discard() {
+    governor.wake();
+    std::unique_lock<std::mutex> lk(lock);
+    epoch++;
+    jobs.clear();
+    has_room.notify_all();
+    idle.wait(lk, [this] { return busy == 0; });
+}
+
+void uring_engine::cancel() {
+    canceled = true;
+    discard();
+}
+
+#endif // HAVE_IO_URING
+
+std::unique_ptr<read_engine> read_engine::create(kind k, size_t threads, size_t depth, io_governor &governor,
+                                                 std::atomic<uint64_t> *bytes, size_t inflight) {
+#ifdef HAVE_IO_URING
+    if (k != PREAD) {
+        std::unique_ptr<uring_engine> engine(new uring_engine(depth, inflight, governor, bytes));
+        if (engine->start(threads)) return std::unique_ptr<read_engine>(engine.release());
+    }
+#endif
+    return std::unique_ptr<read_engine>(new pread_engine(threads, depth, governor, bytes));
+}
+
+bool read_engine::parse(const std::string &name, kind &k) {
+    if (name == "auto") k = AUTO;
+    else if (name == "pread") k = PREAD;
+    else if (name == "uring" || name == "io_uring") k = URING;
+    else return false;
+    return true;
+}
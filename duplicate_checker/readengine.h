@@ -0,0 +1,51 @@
+#ifndef READENGINE_H
+#define READENGINE_H
+
+#include "hasher.h"
+#include "iopolicy.h"
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/* a range of one file to be read into a hasher */
+struct read_job {
+    std::string path;
+    int64_t offset;
+    int64_t length;                   // -1 reads up to the end of the file
+    uint64_t dev = 0;                 // device of the file, engines scheduling per device use it
+    std::unique_ptr<hasher> hash;
+    /* called from an engine thread when the range is read or could not be read;
+     * jobs stopped by discard or cancel are dropped without a call */
+    std::function<void(bool ok, hasher &hash)> done;
+};
+
+/* reads ranges of many files at once and feeds the data to their hashers as it arrives */
+class read_engine {
+public:
+    enum kind {AUTO, PREAD, URING};
+
+    virtual ~read_engine() = default;
+
+    /* queues a job, waiting at most timeout for a free slot; false if the queue stayed full */
+    virtual bool push(read_job &&job, std::chrono::milliseconds timeout) = 0;
+    /* true once every job is done */
+    virtual bool wait(std::chrono::milliseconds timeout) = 0;
+    /* drops queued jobs and stops running ones after their current read */
+    virtual void discard() = 0;
+    /* like discard, but the engine takes no more jobs */
+    virtual void cancel() = 0;
+    virtual const char *name() const = 0;
+
+    /* files are opened and read as the governor says, bytes hashed are added to *bytes; AUTO and URING
+     * fall back to a pread pool when io_uring is not compiled in or cannot be set up, e.g. under seccomp;
+     * inflight caps the files an io_uring thread reads at once, pread threads read one each anyway */
+    static std::unique_ptr<read_engine> create(kind k, size_t threads, size_t depth, io_governor &governor,
+                                               std::atomic<uint64_t> *bytes, size_t inflight = 0);
+    static bool parse(const std::string &name, kind &k);
+};
+
+#endif // READENGINE_H
@@ -0,0 +1,198 @@
+#include "reclaimer.h"
+#include "hashpool.h"
+
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+const std::chrono::milliseconds POLL_PERIOD(100);
+const size_t MAX_ERRORS = 10;
+const char TEMP_SUFFIX[] = ".dc-reclaim";
+
+static int64_t mtime_of(const struct stat &st) {
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+reclaimer::reclaimer(action act, size_t threads) : act(act), threads(threads), done(0), changed(0), failed(0), bytes(0) {
+    if (this->threads == 0) this->threads = std::thread::hardware_concurrency();
+    if (this->threads == 0) this->threads = 1;
+}
+
+reclaimer::report reclaimer::run(const std::vector<reclaim_item> &items, const std::function<bool()> &interrupted,
+                                 const std::function<void(size_t, size_t)> &progress) {
+    std::map<std::string, std::vector<const reclaim_item *>> dirs;
+    for (auto &item : items) {
+        size_t slash = item.path.rfind('/');
+        std::string dir = (slash == std::string::npos) ? "." : (slash == 0) ? "/" : item.path.substr(0, slash);
+        dirs[dir].push_back(&item);
+    }
+    {
+        hash_pool pool(threads, 2 * threads);
+        for (auto &d : dirs) {
+            const std::string *dir = &d.first;
+            const std::vector<const reclaim_item *> *batch = &d.second;
+            while (!pool.push([this, dir, batch, &interrupted]() { run_directory(*dir, *batch, interrupted); }, POLL_PERIOD)) {
+                progress(done + changed + failed, items.size());
+            }
+            if (interrupted()) break;
+        }
+        while (!pool.wait(POLL_PERIOD)) {
+            progress(done + changed + failed, items.size());
+            if (interrupted()) pool.discard();
+        }
+    }
+    progress(done + changed + failed, items.size());
+    uint64_t handled = done + changed + failed;
+    return report{done, changed, failed, items.size() - handled, bytes, errors};
+}
+
+void reclaimer::run_directory(const std::string &dir, const std::vector<const reclaim_item *> &items,
+                              const std::function<bool()> &interrupted) {
+    if (interrupted()) return;
+    int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        std::string error = strerror(errno);
+        for (auto *item : items) fail(item->path, error);
+        return;
+    }
+    for (auto *item : items) {
+        if (interrupted()) break;
+        const char *name = item->path.c_str() + (item->path.rfind('/') + 1);
+        struct stat st;
+        if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno == ENOENT) {
+                changed++;
+            } else {
+                fail(item->path, strerror(errno));
+            }
+            continue;
+        }
+        /* anything written, replaced or linked since the scan is left as it is */
+        if (!S_ISREG(st.st_mode) || st.st_size != item->size || mtime_of(st) != item->mtime
+                || static_cast<uint64_t>(st.st_dev) != item->dev || static_cast<uint64_t>(st.st_ino) != item->inode) {
+            changed++;
+            continue;
+        }
+        if (act == DELETE) {
+            if (unlinkat(dirfd, name, 0) != 0) {
+                fail(item->path, strerror(errno));
+                continue;
+            }
+            freed(*item, st);
+            done++;
+            continue;
+        }
+        std::string error;
+        if (replace(dirfd, name, *item, st, error)) {
+            freed(*item, st);
+            done++;
+        } else if (error.empty()) {
+            changed++;
+        } else {
+            fail(item->path, error);
+        }
+    }
+    close(dirfd);
+}
+
+bool reclaimer::replace(int dirfd, const char *name, const reclaim_item &item, const struct stat &st, std::string &error) {
+    struct stat ks;
+    if (stat(item.keep.c_str(), &ks) != 0 || !S_ISREG(ks.st_mode) || ks.st_size != item.size || mtime_of(ks) != item.keep_mtime
+            || static_cast<uint64_t>(ks.st_dev) != item.keep_dev || static_cast<uint64_t>(ks.st_ino) != item.keep_inode) {
+        return false;
+    }
+    /* the new file is made under a hidden name next to the old one and renamed over it */
+    std::string temp = std::string(".") + name + TEMP_SUFFIX;
+    if (act == HARDLINK) {
+        if (ks.st_dev != st.st_dev) {
+            error = "the kept copy is on another file system";
+            return false;
+        }
+        if (linkat(AT_FDCWD, item.keep.c_str(), dirfd, temp.c_str(), 0) != 0) {
+            error = strerror(errno);
+            return false;
+        }
+    } else {
+#ifdef FICLONE
+        int from = open(item.keep.c_str(), O_RDONLY | O_CLOEXEC);
+        if (from < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        int to = openat(dirfd, temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+        if (to < 0) {
+            error = strerror(errno);
+            close(from);
+            return false;
+        }
+        bool cloned = ioctl(to, FICLONE, from) == 0;
+        if (!cloned) {
+            error = (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL || errno == ENOTTY)
+                    ? "reflinks are not supported between these files" : strerror(errno);
+        } else {
+            /* the replacement looks like the file it replaces, only its extents are shared; the mode
+             * is set again after the owner, the umask cut it and a new owner clears setuid bits */
+            struct timespec times[2] = {st.st_atim, st.st_mtim};
+            if (fchown(to, st.st_uid, st.st_gid) != 0) {
+                error = std::string("cannot keep the owner: ") + strerror(errno);
+            } else if (fchmod(to, st.st_mode & 07777) != 0) {
+                error = std::string("cannot keep the permissions: ") + strerror(errno);
+            } else if (futimens(to, times) != 0) {
+                error = std::string("cannot keep the times: ") + strerror(errno);
+            }
+            cloned = error.empty();
+        }
+        close(to);
+        close(from);
+        if (!cloned) {
+            unlinkat(dirfd, temp.c_str(), 0);
+            return false;
+        }
+#else
+        error = "reflinks are not supported by this build";
+        return false;
+#endif
+    }
+    if (renameat(dirfd, temp.c_str(), dirfd, name) != 0) {
+        error = strerror(errno);
+        unlinkat(dirfd, temp.c_str(), 0);
+        return false;
+    }
+    return true;
+}
+
+void reclaimer::freed(const reclaim_item &item, const struct stat &st) {
+    /* blocks come back with the last link: the one seen alone right before it went, or the
+     * last of those the scan saw when threads removed them side by side */
+    std::lock_guard<std::mutex> lg(lock);
+    uint32_t &n = unlinked[inode_key(item.dev, item.inode)];
+    if (++n == item.nlink || st.st_nlink == 1) bytes += static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+void reclaimer::fail(const std::string &path, const std::string &error) {
+    failed++;
+    std::lock_guard<std::mutex> lg(lock);
+    if (errors.size() < MAX_ERRORS) errors.push_back(path + ": " + error);
+}
+
+bool reclaimer::parse(const std::string &name, action &act) {
+    if (name == "delete") act = DELETE;
+    else if (name == "hardlink") act = HARDLINK;
+    else if (name == "reflink") act = REFLINK;
+    else return false;
+    return true;
+}
+
+const char *reclaimer::name(action act) {
+    switch (act) {
+        case HARDLINK: return "hardlink";
+        case REFLINK: return "reflink";
+        default: return "delete";
+    }
+}
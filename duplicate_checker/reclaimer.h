@@ -0,0 +1,66 @@
+#ifndef RECLAIMER_H
+#define RECLAIMER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+struct stat;
+
+/* a duplicate to get rid of and the copy that stays, both as the scan saw them */
+struct reclaim_item {
+    std::string path;
+    int64_t size, mtime;
+    uint64_t dev, inode;
+    uint32_t nlink;
+    std::string keep;
+    int64_t keep_mtime;
+    uint64_t keep_dev, keep_inode;
+};
+
+/* frees the space of duplicates from worker threads: items are batched by directory, which is
+ * opened once for all its *at calls; every file is checked against the scan right before it is
+ * touched, so a file changed since is left alone, and a replaced file is swapped in with one rename */
+class reclaimer {
+public:
+    enum action {DELETE, HARDLINK, REFLINK};
+
+    struct report {
+        uint64_t done, changed, failed;
+        uint64_t left;                      // not touched, the run was stopped before them
+        uint64_t bytes;                     // blocks actually freed, counted when the last link of an inode goes
+        std::vector<std::string> errors;    // the first few only
+    };
+
+private:
+    typedef std::pair<uint64_t, uint64_t> inode_key;
+
+    action act;
+    size_t threads;
+    std::atomic<uint64_t> done, changed, failed, bytes;
+    std::mutex lock;
+    std::map<inode_key, uint32_t> unlinked;  // links removed per inode
+    std::vector<std::string> errors;
+
+    void run_directory(const std::string &dir, const std::vector<const reclaim_item *> &items,
+                       const std::function<bool()> &interrupted);
+    bool replace(int dirfd, const char *name, const reclaim_item &item, const struct stat &st, std::string &error);
+    void freed(const reclaim_item &item, const struct stat &st);
+    void fail(const std::string &path, const std::string &error);
+
+public:
+    explicit reclaimer(action act, size_t threads = 0);
+
+    /* progress gets items handled so far and in all; interrupted stops between files */
+    report run(const std::vector<reclaim_item> &items, const std::function<bool()> &interrupted,
+               const std::function<void(size_t, size_t)> &progress);
+
+    static bool parse(const std::string &name, action &act);
+    static const char *name(action act);
+};
+
+#endif // RECLAIMER_H
@@ -0,0 +1,300 @@
+#include "resultmodel.h"
+
+#include <QBrush>
+#include <QColor>
+#include <QDateTime>
+#include <QFile>
+#include <algorithm>
+#include <cstring>
+
+const size_t BATCH = 256;
+const int COLUMNS = 5;
+const QString FORMAT = "d MMMM yyyy, hh:mm:ss";
+const char *const HEADERS[] = {"Name", "Type", "Size", "Path", "Last modified"};
+const char *const STATE_NAMES[] = {"OK", "DELETE", "LINK"};
+
+/* a group row has id 0, a file row has the number of its group plus one */
+static quintptr group_id(uint32_t g) { return static_cast<quintptr>(g) + 1; }
+
+result_model::result_model(QObject *parent) : QAbstractItemModel(parent), fetched(0), marked(0),
+                                              sort_column(-1), sort_order(Qt::AscendingOrder) {}
+
+size_t result_model::groups() const {
+    return (res) ? file_groups() + res->trees.trees.size() : 0;
+}
+
+size_t result_model::file_groups() const {
+    return (res) ? res->duplicates.size() + res->hardlinks.size() : 0;
+}
+
+const std::vector<uint32_t> &result_model::group(uint32_t g) const {
+    if (g < res->duplicates.size()) return res->duplicates[g];
+    if (g < file_groups()) return res->hardlinks[g - res->duplicates.size()];
+    return res->trees.trees[g - file_groups()];
+}
+
+std::string result_model::group_path(uint32_t g) const {
+    return (is_tree(g)) ? res->files.dir_path(group(g)[0]) : res->files.path(group(g)[0]);
+}
+
+int64_t result_model::group_size(uint32_t g) const {
+    return (is_tree(g)) ? static_cast<int64_t>(res->trees.bytes[g - file_groups()]) : res->files.size[group(g)[0]];
+}
+
+bool result_model::links_only(uint32_t g) const {
+    return g >= res->duplicates.size() && !is_tree(g);
+}
+
+uint32_t result_model::file_at(const QModelIndex &index) const {
+    return group(static_cast<uint32_t>(index.internalId() - 1))[index.row()];
+}
+
+void result_model::set_result(std::shared_ptr<const scan_result> result) {
+    beginResetModel();
+    res = std::move(result);
+    states.assign(res->files.files(), OK);
+    dir_states.assign(res->trees.copy_of.size(), OK);
+    marked = 0;
+    /* paths of the first inode of a duplicate group are kept, the others are links or copies;
+     * files in the kept copy of a tree stay too */
+    for (auto &dirs : res->trees.trees) {
+        for (size_t k = 1; k < dirs.size(); k++) dir_states[dirs[k]] = DELETE;
+    }
+    for (uint32_t g = 0; g < file_groups(); g++) {
+        auto &files = group(g);
+        for (size_t j = 0; j < files.size(); j++) {
+            bool linked = j > 0 && res->files.same_inode(files[j], files[0]);
+            bool kept = j == 0 || linked || res->trees.copy_at(res->files.dir[files[j]]) == tree_groups::KEPT;
+            if (links_only(g) || linked) {
+                states[files[j]] = LINK;
+            } else if (!kept) {
+                states[files[j]] = DELETE;
+                marked++;
+            }
+        }
+    }
+    rebuild();
+    endResetModel();
+}
+
+void result_model::reset() {
+    beginResetModel();
+    res.reset();
+    states.clear();
+    dir_states.clear();
+    rows.clear();
+    row_of.clear();
+    fetched = marked = 0;
+    endResetModel();
+}
+
+void result_model::set_filter(const QString &text) {
+    if (text == filter) return;
+    beginResetModel();
+    filter = text;
+    rebuild();
+    endResetModel();
+}
+
+void result_model::sort(int column, Qt::SortOrder order) {
+    beginResetModel();
+    sort_column = column;
+    sort_order = order;
+    rebuild();
+    endResetModel();
+}
+
+void result_model::rebuild() {
+    rows.clear();
+    fetched = 0;
+    size_t n = groups();
+    for (uint32_t g = 0; g < n; g++) {
+        if (res->trees.is_collapsed(g)) continue;
+        if (!filter.isEmpty()) {
+            bool found = false;
+            for (uint32_t f : group(g)) {
+                std::string path = (is_tree(g)) ? res->files.dir_path(f) : res->files.path(f);
+                if (QFile::decodeName(path.c_str()).contains(filter, Qt::CaseInsensitive)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) continue;
+        }
+        rows.push_back(g);
+    }
+    if (sort_column >= 0) {
+        auto key_less = [this](uint32_t g1, uint32_t g2) {
+            auto &a = group(g1), &b = group(g2);
+            auto name = [this](uint32_t g, uint32_t x) { return (is_tree(g)) ? res->files.dir_name_of(x) : res->files.name_of(x); };
+            auto mtime = [this](uint32_t g, uint32_t x) { return (is_tree(g)) ? 0 : res->files.mtime[x]; };
+            switch (sort_column) {
+                case 0: return strcmp(name(g1, a[0]), name(g2, b[0])) < 0;
+                case 1: return a.size() < b.size();
+                case 2: return group_size(g1) < group_size(g2);
+                case 3: return group_path(g1) < group_path(g2);
+                case 4: return mtime(g1, a[0]) < mtime(g2, b[0]);
+                default: return g1 < g2;
+            }
+        };
+        if (sort_order == Qt::AscendingOrder) {
+            std::stable_sort(rows.begin(), rows.end(), key_less);
+        } else {
+            std::stable_sort(rows.begin(), rows.end(), [&](uint32_t g1, uint32_t g2) { return key_less(g2, g1); });
+        }
+    }
+    row_of.assign(n, static_cast<uint32_t>(rows.size()));
+    for (size_t r = 0; r < rows.size(); r++) row_of[rows[r]] = static_cast<uint32_t>(r);
+    fetched = std::min(rows.size(), BATCH);
+}
+
+void result_model::mark_copy(uint32_t dir, uint8_t state) {
+    /* the files of a copy are in collapsed groups only, which have no rows of their own */
+    dir_states[dir] = state;
+    for (uint32_t g = 0; g < res->duplicates.size(); g++) {
+        if (!res->trees.is_collapsed(g)) continue;
+        for (uint32_t f : res->duplicates[g]) {
+            if (states[f] == LINK || states[f] == state || res->trees.top_of(res->files, res->files.dir[f]) != dir) continue;
+            if (state == DELETE && res->files.same_inode(f, res->duplicates[g][0])) continue;
+            if (state == DELETE) {
+                marked++;
+            } else {
+                marked--;
+            }
+            states[f] = state;
+        }
+    }
+}
+
+bool result_model::toggle(const QModelIndex &index) {
+    if (!index.isValid() || index.internalId() == 0) return false;
+    uint32_t g = static_cast<uint32_t>(index.internalId() - 1);
+    if (is_tree(g)) {
+        uint32_t d = group(g)[index.row()];
+        mark_copy(d, (dir_states[d] == OK) ? DELETE : OK);
+        emit dataChanged(this->index(index.row(), 0, index.parent()), this->index(index.row(), COLUMNS - 1, index.parent()));
+        return true;
+    }
+    uint8_t &s = states[file_at(index)];
+    if (s == LINK) return false;
+    if (s == OK) {
+        s = DELETE;
+        marked++;
+    } else {
+        s = OK;
+        marked--;
+    }
+    emit dataChanged(this->index(index.row(), 0, index.parent()), this->index(index.row(), COLUMNS - 1, index.parent()));
+    return true;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> result_model::plan_for_deleting() const {
+    std::vector<std::pair<uint32_t, uint32_t>> plan;
+    for (uint32_t g = 0; g < file_groups(); g++) {
+        auto &files = group(g);
+        for (uint32_t f : files) {
+            if (states[f] == DELETE) plan.push_back(std::make_pair(f, files[0]));
+        }
+    }
+    return plan;
+}
+
+QModelIndex result_model::index(int row, int column, const QModelIndex &parent) const {
+    if (row < 0 || column < 0 || column >= COLUMNS) return QModelIndex();
+    if (!parent.isValid()) {
+        if (static_cast<size_t>(row) >= fetched) return QModelIndex();
+        return createIndex(row, column, quintptr(0));
+    }
+    if (parent.internalId() != 0) return QModelIndex();
+    uint32_t g = rows[parent.row()];
+    if (static_cast<size_t>(row) >= group(g).size()) return QModelIndex();
+    return createIndex(row, column, group_id(g));
+}
+
+QModelIndex result_model::parent(const QModelIndex &child) const {
+    if (!child.isValid() || child.internalId() == 0) return QModelIndex();
+    uint32_t g = static_cast<uint32_t>(child.internalId() - 1);
+    return createIndex(row_of[g], 0, quintptr(0));
+}
+
+int result_model::rowCount(const QModelIndex &parent) const {
+    if (!parent.isValid()) return static_cast<int>(fetched);
+    if (parent.internalId() != 0 || parent.column() != 0) return 0;
+    return static_cast<int>(group(rows[parent.row()]).size());
+}
+
+int result_model::columnCount(const QModelIndex &) const {
+    return COLUMNS;
+}
+
+bool result_model::hasChildren(const QModelIndex &parent) const {
+    if (!parent.isValid()) return !rows.empty();
+    return parent.internalId() == 0 && parent.column() == 0;
+}
+
+bool result_model::canFetchMore(const QModelIndex &parent) const {
+    return !parent.isValid() && fetched < rows.size();
+}
+
+void result_model::fetchMore(const QModelIndex &parent) {
+    if (parent.isValid()) return;
+    size_t more = std::min(rows.size() - fetched, BATCH);
+    if (more == 0) return;
+    beginInsertRows(QModelIndex(), static_cast<int>(fetched), static_cast<int>(fetched + more - 1));
+    fetched += more;
+    endInsertRows();
+}
+
+QVariant result_model::data(const QModelIndex &index, int role) const {
+    if (!index.isValid()) return QVariant();
+    if (index.internalId() == 0) {
+        uint32_t g = rows[index.row()];
+        auto &files = group(g);
+        if (role != Qt::DisplayRole) return QVariant();
+        if (is_tree(g)) {
+            switch (index.column()) {
+                case 0: return QFile::decodeName(res->files.dir_name_of(files[0]));
+                case 1: return QString("%1 copies of %2 files").arg(files.size()).arg(res->trees.files[g - file_groups()]);
+                case 2: return QString::number(group_size(g));
+                case 3: return QFile::decodeName(group_path(g).c_str());
+                default: return QVariant();
+            }
+        }
+        switch (index.column()) {
+            case 0: return QFile::decodeName(res->files.name_of(files[0]));
+            case 1: return QString("%1 %2").arg(files.size()).arg((links_only(g)) ? "links" : "copies");
+            case 2: return QString::number(res->files.size[files[0]]);
+            case 3: return QFile::decodeName(res->files.dir_path(res->files.dir[files[0]]).c_str());
+            default: return QVariant();
+        }
+    }
+    uint32_t g = static_cast<uint32_t>(index.internalId() - 1);
+    if (is_tree(g)) {
+        uint32_t d = group(g)[index.row()];
+        if (role == Qt::ForegroundRole) return QBrush(QColor((dir_states[d] == DELETE) ? Qt::red : Qt::black));
+        if (role != Qt::DisplayRole) return QVariant();
+        switch (index.column()) {
+            case 0: return QFile::decodeName(res->files.dir_name_of(d));
+            case 1: return QString(STATE_NAMES[dir_states[d]]);
+            case 2: return QString::number(group_size(g));
+            case 3: return QFile::decodeName(res->files.dir_path(d).c_str());
+            default: return QVariant();
+        }
+    }
+    uint32_t f = file_at(index);
+    if (role == Qt::ForegroundRole) return QBrush(QColor((states[f] == DELETE) ? Qt::red : Qt::black));
+    if (role != Qt::DisplayRole) return QVariant();
+    switch (index.column()) {
+        case 0: return QFile::decodeName(res->files.name_of(f));
+        case 1: return QString(STATE_NAMES[states[f]]);
+        case 2: return QString::number(res->files.size[f]);
+        case 3: return QFile::decodeName(res->files.path(f).c_str());
+        case 4: return QDateTime::fromMSecsSinceEpoch(res->files.mtime[f] / 1000000).toString(FORMAT);
+        default: return QVariant();
+    }
+}
+
+QVariant result_model::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole || section < 0 || section >= COLUMNS) return QVariant();
+    return QString(HEADERS[section]);
+}
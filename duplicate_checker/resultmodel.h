@@ -0,0 +1,69 @@
+#ifndef RESULTMODEL_H
+#define RESULTMODEL_H
+
+#include "scantools.h"
+
+#include <QAbstractItemModel>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+/* duplicate groups, hardlink sets and copied directories of a finished scan as a two-level tree;
+ * rows are built on demand from the file table, top-level rows are fetched in batches; groups
+ * whose files all lie in copied directories are shown through the directories only */
+class result_model : public QAbstractItemModel {
+    Q_OBJECT
+
+public:
+    enum state : uint8_t {OK, DELETE, LINK};
+
+private:
+    std::shared_ptr<const scan_result> res;
+    std::vector<uint8_t> states;           // by file id
+    std::vector<uint8_t> dir_states;       // by directory id, for the copies in the trees
+    std::vector<uint32_t> rows;            // visible groups in view order
+    std::vector<uint32_t> row_of;          // by group, rows.size() if filtered out
+    size_t fetched;
+    size_t marked;
+    int sort_column;
+    Qt::SortOrder sort_order;
+    QString filter;
+
+    /* groups are numbered duplicates first, then hardlink sets, then trees */
+    size_t groups() const;
+    size_t file_groups() const;
+    const std::vector<uint32_t> &group(uint32_t g) const;
+    bool links_only(uint32_t g) const;
+    bool is_tree(uint32_t g) const { return g >= file_groups(); }
+    std::string group_path(uint32_t g) const;
+    int64_t group_size(uint32_t g) const;
+    uint32_t file_at(const QModelIndex &index) const;
+    void mark_copy(uint32_t dir, uint8_t state);
+    void rebuild();
+
+public:
+    explicit result_model(QObject *parent = nullptr);
+
+    void set_result(std::shared_ptr<const scan_result> result);
+    void reset();
+    void set_filter(const QString &text);
+    /* switches a file or a copied directory with its files between OK and DELETE, false for groups and links */
+    bool toggle(const QModelIndex &index);
+    size_t number_for_deleting() const { return marked; }
+    /* files marked for deleting, each with the first file of its group, which stays */
+    std::vector<std::pair<uint32_t, uint32_t>> plan_for_deleting() const;
+    std::shared_ptr<const scan_result> result() const { return res; }
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+};
+
+#endif // RESULTMODEL_H
@@ -0,0 +1,63 @@
+# Scanning core shared by the GUI and the command-line tool, it depends on QtCore only
+
+INCLUDEPATH += $$PWD
+CONFIG += c++14
+
+# Optional SIMD hash backends, picked up when the libraries are installed
+CONFIG += link_pkgconfig
+packagesExist(libxxhash) {
+    PKGCONFIG += libxxhash
+    DEFINES += HAVE_XXHASH
+}
+packagesExist(libblake3) {
+    PKGCONFIG += libblake3
+    DEFINES += HAVE_BLAKE3
+}
+
+# io_uring reads need only the kernel headers, the raw syscalls are used without liburing
+linux:exists(/usr/include/linux/io_uring.h) {
+    DEFINES += HAVE_IO_URING
+}
+
+SOURCES += \
+    $$PWD/scantools.cpp \
+    $$PWD/dirwalker.cpp \
+    $$PWD/walkfilter.cpp \
+    $$PWD/hashpool.cpp \
+    $$PWD/readengine.cpp \
+    $$PWD/devices.cpp \
+    $$PWD/iopolicy.cpp \
+    $$PWD/hasher.cpp \
+    $$PWD/hashcache.cpp \
+    $$PWD/checkpoint.cpp \
+    $$PWD/comparer.cpp \
+    $$PWD/chunker.cpp \
+    $$PWD/reclaimer.cpp \
+    $$PWD/filetable.cpp \
+    $$PWD/profiler.cpp \
+    $$PWD/sizeindex.cpp \
+    $$PWD/spill.cpp \
+    $$PWD/treematch.cpp \
+    $$PWD/watcher.cpp
+
+HEADERS += \
+    $$PWD/scantools.h \
+    $$PWD/dirwalker.h \
+    $$PWD/walkfilter.h \
+    $$PWD/hashpool.h \
+    $$PWD/readengine.h \
+    $$PWD/devices.h \
+    $$PWD/iopolicy.h \
+    $$PWD/hasher.h \
+    $$PWD/hashcache.h \
+    $$PWD/checkpoint.h \
+    $$PWD/comparer.h \
+    $$PWD/chunker.h \
+    $$PWD/reclaimer.h \
+    $$PWD/filetable.h \
+    $$PWD/profiler.h \
+    $$PWD/sizeindex.h \
+    $$PWD/spill.h \
+    $$PWD/radix.h \
+    $$PWD/treematch.h \
+    $$PWD/watcher.h
@@ -1,56 +1,175 @@
 #include "scantools.h"
+#include "comparer.h"
+#include "profiler.h"
+#include "checkpoint.h"
+#include "radix.h"
 
 #include <QDir>
 #include <QDebug>
 #include <algorithm>
-#include <QCryptographicHash>
 #include <QFileInfoList>
 #include <QDateTime>
 #include <QThread>
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <limits>
+#include <map>
+#include <set>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
-const size_t BLOCK_SIZE = 1024 * 1024;
+const std::chrono::milliseconds POLL_PERIOD(10);
+const std::chrono::milliseconds NO_WAIT(0);
+const std::chrono::milliseconds DEFER_PAUSE(1);
+const qint64 REPORT_PERIOD = 100;
+const int CHECKPOINT_PERIOD = 120; // seconds
+const char CHECKPOINT_MAGIC[4] = {'D', 'C', 'C', 'P'};
+const uint32_t CHECKPOINT_VERSION = 4;
+const qint64 PARTIAL_SIZE = 4 * 1024;
+const qint64 PARTIAL_LIMIT = 64 * 1024; // smaller files are hashed in full right away
+const qint64 SIMILAR_MIN_SIZE = 64 * 1024; // smaller files hold too few chunks to compare
+const size_t SIMILAR_SHOWN = 20;
+const char *const STAGE_NAMES[] = {"head", "tail", "middle", "full"};
 const QString FORMAT = "d MMMM yyyy, hh:mm:ss";
+const size_t SORT_RUN = 64 * 1024; // elements sorted between two safe points
+const char *const STATE_NAMES[] = {"scanning directories", "sorting files by size", "calculating hashes", "sorting files by hash",
+                                   "grouping files", "sorting files by name", "finding similar files", "showing results", "finished"};
+
+/* std::sort in runs followed by merges, interrupted() is asked between them, so a pause
+ * never waits for a whole sort of millions of files; false if it stopped, the range is
+ * then a permutation in no particular order */
+template<class It, class Less, class Stop>
+static bool sort_interruptible(It begin, It end, Less less, Stop interrupted) {
+    size_t n = end - begin;
+    for (size_t b = 0; b < n; b += SORT_RUN) {
+        if (interrupted()) return false;
+        std::sort(begin + b, begin + std::min(n, b + SORT_RUN), less);
+    }
+    for (size_t width = SORT_RUN; width < n; width *= 2) {
+        for (size_t b = 0; b + width < n; b += 2 * width) {
+            if (interrupted()) return false;
+            std::inplace_merge(begin + b, begin + b + width, begin + std::min(n, b + 2 * width), less);
+        }
+    }
+    return true;
+}
+
+static std::string cache_path() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QDir().mkpath(dir);
+    return QFile::encodeName(dir + "/hashes.cache").toStdString();
+}
+
+static std::string checkpoint_path(const QString &name = "scan.checkpoint") {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    QDir().mkpath(dir);
+    return QFile::encodeName(dir + "/" + name).toStdString();
+}
+/* two files take turns, the one the last checkpoint refers to is never written in full */
+static std::string table_path(uint64_t stamp) {
+    return checkpoint_path(QString("scan.table%1").arg(stamp % 2));
+}
 
 scantools::scantools(bool mode) : mode(mode) {
     saved0 = saved1 = result = 0;
+    reclaimable = 0;
+    streaming = false;
+    pipelined = false;
+    watching = false;
+    matching_trees = true;
+    similar_ratio = 0;
+    memory_budget = 0;
+    checkpoint_period = CHECKPOINT_PERIOD;
+    checkpoint_at = 0;
+    table_stamp = table_length = 0;
+    table_state = table_hash_stage = 0;
+    table_order = 0;
+    hash_threads = QThread::idealThreadCount();
+    hash_queue = 4 * hash_threads;
+    reader = read_engine::AUTO;
+    scheduling = true;
+    algorithm = hasher::best();
+    caching = true;
     main_state = PREPARED;
-    QDir::setCurrent(QDir::homePath());
+    request = NONE;
+    hash_stage = HEAD;
+    roots = QStringList(QDir::currentPath());
     scanning_state = SCAN_DIRS;
+    memset(stats, 0, sizeof(stats));
+    memset(rejected, 0, sizeof(rejected));
 }
 
 void scantools::start() {
-    try {
-        if (is_canceled()) throw cancel_exception();
-        main_state = SCANNING;
-        emit started();
-        while (scanning_state != END) {
-            switch (scanning_state) {
-                case SCAN_DIRS: scan_directories(saved0); break;
-                case SORT_SIZE: sort_by_size(); break;
-                case CALC_HASH: calculate_hashes(saved0, saved1); break;
-                case SORT_HASH: sort_by_hash(saved0); break;
-                case GROUP_DUPL: group_duplicates(saved0, saved1); break;
-                case SORT_NAME: sort_by_name(saved0); break;
-                case SHOW_RES: show_results(saved0, saved1); break;
-                default: scanning_state = END;
-            }
-            saved0 = saved1 = 0;
+    if (request == CANCEL || QThread::currentThread()->isInterruptionRequested()) {
+        clear();
+        main_state = CANCELED;
+        emit console("CANCELED", false, "orange");
+        emit canceled();
+        return;
+    }
+    request = NONE;
+    main_state = SCANNING;
+    if (scanning_state == SCAN_DIRS && dirs.empty()) {
+        memset(stats, 0, sizeof(stats));
+        memset(rejected, 0, sizeof(rejected));
+        governor.clear();
+        devices.forget();
+        stop_watching();
+        profiler::enable(!trace_path.isEmpty());
+        profiler::clear();
+    }
+    emit started();
+    schedule_checkpoint();
+    bool done = true;
+    while (done && scanning_state != END) {
+        size_t i0 = saved0, j0 = saved1;
+        saved0 = saved1 = 0;
+        progress.stage = scanning_state;
+        progress.items = progress.total = 0;
+        int stage = scanning_state;
+        QElapsedTimer timer;
+        timer.start();
+        profiler::begin_stage(STATE_NAMES[stage]);
+        switch (scanning_state) {
+            case SCAN_DIRS: done = scan_directories(); break;
+            case SORT_SIZE: done = sort_by_size(); break;
+            case CALC_HASH: done = calculate_hashes(j0); break;
+            case SORT_HASH: done = sort_by_hash(i0); break;
+            case GROUP_DUPL: done = group_duplicates(i0); break;
+            case SORT_NAME: done = sort_by_name(i0); break;
+            case FIND_SIMILAR: done = find_similar(); break;
+            case SHOW_RES: done = show_results(); break;
+            default: scanning_state = END;
         }
-        result = 0;
-        for (size_t i = 0; i < duplicates.size(); i++) {
-            result += duplicates[i].size() - 1;
+        if (stage < STAGES) {
+            stats[stage].nanoseconds += timer.nsecsElapsed();
+            profiler::end_stage(stats[stage].items);
         }
-        emit console("FINISHED", true, "green");
+        if (!done && !interrupted()) {
+            /* nobody asked to stop, the stage made way for a checkpoint */
+            save_checkpoint();
+            schedule_checkpoint();
+            done = true;
+        }
+    }
+    if (done) {
+        progress.stage = END;
+        write_trace();
         main_state = FINISHED;
+        emit console("FINISHED", true, "green");
         clear();
         emit finished();
-    } catch (pause_exception &e) {
-        saved0 = e.get(0);
-        saved1 = e.get(1);
+    } else if (request == PAUSE) {
+        save_checkpoint();
+        main_state = PAUSED;
         emit console("PAUSED", false, "yellow");
         emit paused();
-    } catch (cancel_exception &e) {
+    } else {
         clear();
+        main_state = CANCELED;
         emit console("CANCELED", false, "orange");
         emit canceled();
     }
@@ -58,157 +177,995 @@ void scantools::start() {
 
 void scantools::clear() {
     scanning_state = SCAN_DIRS;
+    hash_stage = HEAD;
     files.clear();
-    while (!dirs.empty()) dirs.pop();
+    dirs.clear();
     duplicates.clear();
+    hardlinks.clear();
+    links.clear();
+    similar.clear();
+    sizes.clear();
+    prehashed.clear();
+    spilled.reset();
+    checkpoint_at = 0;
+    table_stamp = 0;
+    table_flags = std::vector<uint8_t>();
+    /* a finished or canceled scan is not resumed */
+    if (checkpoint_period > 0) {
+        remove_checkpoint(checkpoint_path());
+        for (uint64_t k = 0; k < 2; k++) remove_checkpoint(table_path(k));
+    }
     emit console("", true);
 }
-void scantools::check(size_t i, size_t j) {
-    if (QThread::currentThread()->isInterruptionRequested() || is_canceled()) throw cancel_exception();
-    if (is_paused()) throw pause_exception(i, j);
+bool scantools::interrupted() const {
+    return request != NONE || QThread::currentThread()->isInterruptionRequested();
+}
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+bool scantools::checkpoint_due() const {
+    int64_t at = checkpoint_at;
+    return at > 0 && steady_ms() >= at;
+}
+void scantools::schedule_checkpoint() {
+    /* a spilled scan lives partly in files that go with the process, it is not saved */
+    checkpoint_at = (checkpoint_period > 0 && !spilled) ? steady_ms() + checkpoint_period * 1000LL : 0;
+}
+bool scantools::stop_at(size_t i, size_t j) {
+    saved0 = i;
+    saved1 = j;
+    return false;
+}
+void scantools::pause() {
+    if (main_state == SCANNING) request = PAUSE;
+}
+void scantools::cancel() {
+    request = CANCEL;
 }
 
-void scantools::scan_directories(size_t i0) {
+bool scantools::scan_directories() {
     emit console("scanning directories..", true);
-    emit console(".", true);
-    if (dirs.empty()) dirs.push(main_directory);
-    while (!dirs.empty()) {
-        emit console(QString("scanning ").append(dirs.front()).append(" (0%)"), false);
-        check();
-        QDir d(dirs.front());
-        QFileInfoList list = d.entryInfoList(QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Dirs | QDir::Files);
-        for (size_t i = i0; i < list.size(); i++) {
-            emit console(QString("scanning ").append(dirs.front()).append(" (%1%)").arg((i + 1) * 100 / list.size()), false);
-            check(i);
-            if (list[i].isDir()) dirs.push(list[i].filePath());
-            if (list[i].isFile()) files.emplace_back(list[i]);
+    if (dirs.empty() && files.dirs() == 0) {
+        for (const QString &r : roots) {
+            std::string root = QFile::encodeName(r).toStdString();
+            struct stat st;
+            uint64_t dev = (stat(root.c_str(), &st) == 0) ? st.st_dev : 0;
+            dirs.push_back({files.add_dir(file_table::NO_DIR, root.c_str(), root.size()), root, dev});
+        }
+    }
+    progress.bytes = 0;
+    if (memory_budget > 0 && !spilled) {
+        spilled.reset(new spilled_scan(QFile::encodeName(QDir::tempPath()).toStdString()));
+        checkpoint_at = 0;
+    }
+    /* the engine outlives the walker, whose threads feed it */
+    std::unique_ptr<read_engine> engine;
+    dir_walker walker;
+    /* the index of the pipelined mode holds every path, it does not go with a budget */
+    if (pipelined && !spilled) {
+        if (caching && !cache.is_open()) cache.open(cache_path(), algorithm);
+        engine = create_engine();
+        walker.set_listener([this, &engine](const std::string &prefix, const char *name, const struct stat &st) {
+            prehash_file(*engine, prefix + name, st);
+        });
+    }
+    if (scheduling) walker.set_limits(&devices);
+    walker.set_filter(&filter);
+    if (spilled) {
+        spill_store *store = &spilled->store;
+        walker.set_spill(memory_budget, [store](const file_table &found) { return store->spill(found); });
+    }
+    walker.walk(dirs, files, [this]() {
+        return interrupted() || checkpoint_due();
+    }, [this](size_t d, size_t f) {
+        progress.dirs = d;
+        progress.items = f;
+    });
+    for (int r = 0; r < walk_filter::REASONS; r++) rejected[r] += walker.rejections(static_cast<walk_filter::reason>(r));
+    if (engine) {
+        while (!engine->wait(POLL_PERIOD)) {
+            if (interrupted()) engine->discard();
         }
-        dirs.pop();
+        stats[SCAN_DIRS].bytes += progress.bytes;
     }
+    if (interrupted() || !dirs.empty()) return stop_at(0);
+    size_t found = files.files() + ((spilled) ? spilled->store.record_count() : 0);
+    emit console(QString("scanning directories (%1 directories, %2 files)").arg(progress.dirs).arg(found), false);
+    QStringList left_out;
+    for (int r = walk_filter::NONE + 1; r < walk_filter::REASONS; r++) {
+        if (rejected[r] > 0) left_out << QString("%1 %2").arg(rejected[r]).arg(walk_filter::name(static_cast<walk_filter::reason>(r)));
+    }
+    if (!left_out.isEmpty()) emit console(QString("left out: ").append(left_out.join(", ")), true, "gray");
+    stats[SCAN_DIRS].items = found;
+    if (spilled && !start_spilled()) return stop_at(0);
     scanning_state = SORT_SIZE;
+    return true;
 }
-void scantools::sort_by_size() {
-    emit console("sorting files by size..", false);
-    std::sort(files.begin(), files.end(), [&](const file &f1, const file &f2) {
-        check();
-        return f1.size < f2.size;
-    });
+bool scantools::start_spilled() {
+    spill_store &store = spilled->store;
+    /* a walk that fit the budget goes on in memory as usual */
+    if (store.run_count() == 0 && !store.failed()) {
+        spilled.reset();
+        schedule_checkpoint();
+        return true;
+    }
+    if (!store.failed() && store.spill(files)) files.clear_files();
+    if (store.failed() || !store.start_merge()) {
+        emit console(QString("cannot spill files to disk, %1").arg(QFile::decodeName(store.get_error().c_str())), true, "orange");
+        request = CANCEL;
+        return false;
+    }
+    emit console(QString("%1 files over the memory budget, spilled to %2 runs of %3 MiB in all")
+                 .arg(store.record_count()).arg(store.run_count()).arg(store.byte_count() / (1024 * 1024)), true, "gray");
+    if (matching_trees || similar_ratio > 0) {
+        emit console("directory trees and similar files are not looked for, only groups are kept of a spilled scan", true, "orange");
+    }
+    return true;
+}
+bool scantools::load_batch() {
+    /* whole size groups are read back until the batch takes the budget, at least one of them;
+     * files of a size of their own never come back from disk */
+    files.clear_files();
+    std::vector<spill_store::record> group;
+    while ((files.files() == 0 || files.memory() < memory_budget) && spilled->store.next_group(group)) {
+        for (auto &r : group) {
+            uint64_t at = files.intern(r.name.data(), r.name.size());
+            files.add_file(r.dir, at, r.size, r.mtime, r.dev, r.inode, r.nlink);
+        }
+    }
+    if (files.files() == 0) return false;
+    spilled->loaded = true;
+    spilled->batches++;
+    emit console(QString("batch %1: %2 files of shared sizes read back").arg(spilled->batches).arg(files.files()), true, "gray");
+    return true;
+}
+void scantools::keep_batch() {
+    /* groups of the batch move to a table of their own, the batch makes way for the next one */
+    file_table &t = spilled->groups;
+    auto move = [this, &t](std::vector<std::vector<uint32_t>> &from, std::vector<std::vector<uint32_t>> &to) {
+        for (auto &group : from) {
+            std::vector<uint32_t> ids;
+            for (uint32_t f : group) {
+                const char *name = files.name_of(f);
+                uint32_t id = t.add_file(files.dir[f], t.intern(name, strlen(name)), files.size[f], files.mtime[f],
+                                         files.dev[f], files.inode[f], files.nlink[f]);
+                t.hash[id] = files.hash[f];
+                t.flags[id] = files.flags[f];
+                ids.push_back(id);
+            }
+            to.push_back(std::move(ids));
+        }
+        from.clear();
+    };
+    move(duplicates, spilled->duplicates);
+    move(hardlinks, spilled->hardlinks);
+    spilled->loaded = false;
+}
+bool scantools::finish_batches() {
+    spilled_scan &s = *spilled;
+    if (s.store.failed()) {
+        emit console(QString("cannot read spilled files back, %1").arg(QFile::decodeName(s.store.get_error().c_str())), true, "orange");
+        request = CANCEL;
+        return stop_at(0);
+    }
+    /* the groups of every batch become the table of the result */
+    emit console(QString("%1 batches, %2 files in groups").arg(s.batches).arg(s.groups.files()), true, "gray");
+    files.clear_files();
+    files.append(s.groups);
+    duplicates = std::move(s.duplicates);
+    hardlinks = std::move(s.hardlinks);
+    s.groups.clear();
+    s.duplicates.clear();
+    s.hardlinks.clear();
+    scanning_state = SHOW_RES;
+    return true;
+}
+bool scantools::sort_by_size() {
+    if (spilled && !spilled->loaded && !load_batch()) return finish_batches();
+    emit console("sorting files by size..", true);
+    auto &o = files.order;
+    progress.total = o.size();
+    if (!radix_sort(o.data(), o.size(), [this](uint32_t f) {
+        return static_cast<uint64_t>(files.size[f]);
+    }, [this]() { return interrupted(); })) return stop_at(0);
+    /* a file with a size of its own has no duplicate, it leaves the working set right here */
+    size_t kept = 0;
+    for (size_t b = 0, e; b < o.size(); b = e) {
+        e = b + 1;
+        while (e < o.size() && files.size[o[e]] == files.size[o[b]]) e++;
+        if (e - b < 2) continue;
+        for (size_t k = b; k < e; k++) o[kept++] = o[k];
+    }
+    o.resize(kept);
+    o.shrink_to_fit();
+    stats[SORT_SIZE].items += files.files();
     scanning_state = CALC_HASH;
+    return true;
 }
-void scantools::calculate_hashes(size_t i0, size_t j0) {
-    size_t count = j0;
-    emit console("calculating hashes (0) ..", true);
-    for (size_t i = i0; i < files.size(); i++) {
-        check(i, count);
-        if (i > 0 && files[i - 1].size == files[i].size) {
-            files[i].first = files[i - 1].first;
-        } else {
-            files[i].first = i;
+void scantools::prehash_file(read_engine &engine, std::string &&path, const struct stat &st) {
+    std::vector<size_index::file_ref> candidates;
+    int64_t mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    sizes.add(st.st_size, {std::move(path), static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), mtime}, candidates);
+    /* the first stage a file of this size goes through, see calculate_hashes */
+    int stage = (st.st_size > PARTIAL_LIMIT) ? HEAD : FULL;
+    int64_t size = st.st_size;
+    for (auto &c : candidates) {
+        auto key = std::make_pair(c.dev, c.inode);
+        {
+            std::lock_guard<std::mutex> lg(prehash_lock);
+            if (!prehashed.emplace(key, prehash{stage, false, digest()}).second) continue;
         }
-        if (files[i].skip) continue;
-        if ((i > 0 && files[i - 1].size == files[i].size) || (i + 1 < files.size() && files[i].size == files[i + 1].size)) {
-            count++;
-            emit console(QString("calculating hashes (%1) ..").arg(count), false);
-            QCryptographicHash hash(QCryptographicHash::Md5);
-            QFile f(files[i].path);
-            if (f.exists() && f.open(QFile::ReadOnly)) {
-                hash.addData(&f);
-                f.close();
-                files[i].hash = hash.result().toHex();
-            } else {
-                files[i].skip = true;
+        digest cached;
+        if (caching && cache.peek(c.dev, c.inode, size, c.mtime, stage, cached)) continue;
+        int64_t m = c.mtime;
+        read_job job;
+        job.path = std::move(c.path);
+        job.dev = c.dev;
+        job.offset = 0;
+        job.length = (stage == FULL) ? -1 : PARTIAL_SIZE;
+        job.hash = hasher::create(algorithm);
+        if (stage != FULL) job.hash->add(digest());
+        job.done = [this, key, size, m, stage](bool ok, hasher &hash) {
+            if (!ok) return;
+            digest d = hash.result();
+            if (caching) cache.store(key.first, key.second, size, m, stage, d);
+            std::lock_guard<std::mutex> lg(prehash_lock);
+            prehash &e = prehashed[key];
+            e.d = d;
+            e.done = true;
+        };
+        /* hashing is only an early start, on pause the rest is left to calculate_hashes */
+        while (!engine.push(std::move(job), POLL_PERIOD)) {
+            if (interrupted()) return;
+        }
+    }
+}
+
+std::unique_ptr<read_engine> scantools::create_engine() {
+    if (!scheduling) return read_engine::create(reader, hash_threads, hash_queue, governor, &progress.bytes);
+    return std::unique_ptr<read_engine>(new device_scheduler(reader, hash_threads, hash_queue, devices, governor, &progress.bytes));
+}
+void scantools::report_devices() {
+    if (!scheduling) return;
+    for (auto &d : devices.known()) {
+        QString limit = (d.second.limit == device_limits::UNLIMITED) ? QString("all threads") : QString("%1 at once").arg(d.second.limit);
+        emit console(QString("device %1 (%2): %3").arg(QString::fromStdString(device_limits::name(d.first)))
+                     .arg(device_limits::name(d.second.k)).arg(limit), true, "gray");
+    }
+}
+bool scantools::take_prehashed(uint32_t f) {
+    if (prehashed.empty()) return false;
+    auto it = prehashed.find(std::make_pair(files.dev[f], files.inode[f]));
+    if (it == prehashed.end() || !it->second.done || it->second.stage != hash_stage) return false;
+    files.hash[f] = it->second.d;
+    return true;
+}
+
+bool scantools::calculate_hashes(size_t j0) {
+    if (hash_stage == HEAD && j0 == 0 && !mark_candidates()) return stop_at(0);
+    if (caching && !cache.is_open()) cache.open(cache_path(), algorithm);
+    std::unique_ptr<read_engine> engine = create_engine();
+    if (hash_stage == HEAD && j0 == 0) {
+        emit console(QString("reading files with ").append(engine->name()), true, "gray");
+        report_devices();
+    }
+    std::atomic<uint64_t> &count = progress.items;
+    count = j0;
+    progress.bytes = 0;
+    auto pending = [this](uint32_t f) {
+        return files.has(f, file_table::CANDIDATE) && !files.has(f, file_table::HASHED)
+                && (hash_stage == FULL || files.size[f] > PARTIAL_LIMIT);
+    };
+    /* on pause running reads are stopped and their files hashed again on resume, for a checkpoint
+     * they are finished; files hashed so far are kept */
+    auto stop = [&]() {
+        while (!interrupted() && !engine->wait(POLL_PERIOD)) {}
+        if (request == PAUSE) {
+            engine->discard();
+            size_t left = 0;
+            for (uint32_t f : files.order) left += pending(f);
+            emit console(QString("calculating hashes: %1 (%2 hashed, %3 not yet)").arg(STAGE_NAMES[hash_stage]).arg(count).arg(left), false);
+        } else if (interrupted()) {
+            engine->cancel();
+        }
+        stats[CALC_HASH].bytes += progress.bytes;
+        save_cache();
+        return stop_at(0, count);
+    };
+    while (true) {
+        progress.part = hash_stage;
+        size_t total = count;
+        for (uint32_t f : files.order) total += pending(f);
+        progress.total = total;
+        emit console(QString("calculating hashes: %1 ..").arg(STAGE_NAMES[hash_stage]), true);
+        /* a job whose device queue is full waits in a list of its device, so a slow device never holds up the others */
+        std::map<uint64_t, std::deque<uint32_t>> deferred;
+        auto submit = [&](uint32_t f) {
+            bool full = hash_stage == FULL;
+            qint64 offset = (hash_stage == TAIL) ? files.size[f] - PARTIAL_SIZE : (hash_stage == MIDDLE) ? files.size[f] / 2 : 0;
+            int st = hash_stage;
+            hash_cache *c = (caching) ? &cache : nullptr;
+            file_table *t = &files;
+            read_job job;
+            job.path = files.path(f);
+            job.dev = files.dev[f];
+            job.offset = offset;
+            job.length = (full) ? -1 : PARTIAL_SIZE;
+            job.hash = hasher::create(algorithm);
+            /* partial digests are chained, the full one replaces them */
+            if (!full) job.hash->add(files.hash[f]);
+            job.done = [t, f, st, c, &count](bool ok, hasher &hash) {
+                if (ok) {
+                    t->hash[f] = hash.result();
+                    if (c != nullptr) c->store(t->dev[f], t->inode[f], t->size[f], t->mtime[f], st, t->hash[f]);
+                } else {
+                    t->set(f, file_table::SKIP);
+                    t->set(f, file_table::CANDIDATE, false);
+                    t->hash[f] = digest();
+                }
+                t->set(f, file_table::HASHED);
+                count++;
+            };
+            return engine->push(std::move(job), NO_WAIT);
+        };
+        for (size_t i = 0; i < files.order.size(); i++) {
+            if (interrupted() || checkpoint_due()) return stop();
+            uint32_t f = files.order[i];
+            if (!pending(f)) continue;
+            if (take_prehashed(f)) {
+                files.set(f, file_table::HASHED);
+                count++;
+                continue;
             }
+            if (caching && cache.lookup(files.dev[f], files.inode[f], files.size[f], files.mtime[f], hash_stage, files.hash[f])) {
+                files.set(f, file_table::HASHED);
+                count++;
+                continue;
+            }
+            auto &waiting = deferred[files.dev[f]];
+            if (!waiting.empty() || !submit(f)) waiting.push_back(f);
+        }
+        while (!deferred.empty()) {
+            if (interrupted() || checkpoint_due()) return stop();
+            bool moved = false;
+            for (auto d = deferred.begin(); d != deferred.end();) {
+                while (!d->second.empty() && submit(d->second.front())) {
+                    d->second.pop_front();
+                    moved = true;
+                }
+                d = (d->second.empty()) ? deferred.erase(d) : std::next(d);
+            }
+            if (!moved) std::this_thread::sleep_for(DEFER_PAUSE);
+        }
+        while (!engine->wait(POLL_PERIOD)) {
+            if (interrupted()) return stop();
         }
+        size_t left;
+        if (!narrow_candidates(left)) return stop();
+        emit console(QString("calculating hashes: %1 (%2 hashed, %3 left)").arg(STAGE_NAMES[hash_stage]).arg(count).arg(left), false);
+        stats[CALC_HASH].items += count;
+        count = 0;
+        if (hash_stage == FULL) break;
+        hash_stage = static_cast<hashing_stage>(hash_stage + 1);
     }
+    stats[CALC_HASH].bytes += progress.bytes;
+    save_cache();
+    propagate_links();
+    sizes.clear();
+    prehashed.clear();
+    hash_stage = HEAD;
     scanning_state = SORT_HASH;
+    return true;
+}
+void scantools::save_cache() {
+    if (!cache.is_open()) return;
+    cache.save();
+    emit console(QString("hash cache: %1 hits, %2 misses, %3 entries").arg(cache.get_hits()).arg(cache.get_misses()).arg(cache.get_entries()), true, "gray");
 }
-void scantools::sort_by_hash(size_t i0) {
-    emit console("sorting files by hash (0%) ..", true);
-    for (size_t i = i0; i < files.size(); i++) {
-        emit console(QString("sorting files by hash (%1%) ..").arg((i + 1) * 100 / files.size()), false);
-        check(i);
-        if (i != files[i].first && (i + 1 == files.size() || files[i].size != files[i + 1].size)) {
-            std::sort(files.begin() + files[i].first, files.begin() + i, [&](const file f1, const file f2) {
-                check(i);
-                return f1.hash < f2.hash;
-            });
+size_t scantools::changed_order() const {
+    /* sorting by hash and grouping permute the working set up to where they stopped, the walk
+     * adds to its end; no other stage changes it between two checkpoints */
+    size_t last = table_order;
+    if (scanning_state == SCAN_DIRS) last = files.order.size();
+    if (scanning_state == SORT_HASH || scanning_state == GROUP_DUPL) last = std::max(last, saved0);
+    return last;
+}
+void scantools::table_written(uint64_t stamp, uint64_t length) {
+    table_stamp = stamp;
+    table_length = length;
+    table_state = scanning_state;
+    table_hash_stage = hash_stage;
+    table_end = files.end();
+    table_order = changed_order();
+}
+void scantools::save_checkpoint() {
+    if (checkpoint_period <= 0 || spilled) return;
+    /* files changed within a stage are all in the working set, their flags tell which */
+    bool whole = table_stamp == 0 || table_state != scanning_state || table_hash_stage != hash_stage;
+    uint64_t stamp = (whole) ? table_stamp + 1 : table_stamp;
+    std::vector<uint32_t> changed;
+    uint64_t length;
+    bool ok;
+    if (whole) {
+        checkpoint_writer table(table_path(stamp));
+        table.put(stamp);
+        files.save(table);
+        length = table.position();
+        ok = table.commit();
+    } else {
+        for (uint32_t f : files.order) {
+            if (f < table_flags.size() && files.flags[f] != table_flags[f]) changed.push_back(f);
         }
+        checkpoint_writer table(table_path(stamp), table_length);
+        files.save_changes(table, table_end, changed, table_order, changed_order());
+        length = table.position();
+        ok = table.commit();
+    }
+
+    checkpoint_writer out(checkpoint_path());
+    out.put(CHECKPOINT_MAGIC);
+    out.put(CHECKPOINT_VERSION);
+    out.put<uint32_t>(algorithm);
+    out.put<uint8_t>(mode);
+    out.put<int32_t>(scanning_state);
+    out.put<int32_t>(hash_stage);
+    out.put<uint64_t>(saved0);
+    out.put<uint64_t>(saved1);
+    out.put<uint64_t>(roots.size());
+    for (const QString &r : roots) out.put(r.toStdString());
+    out.put(stamp);
+    out.put(length);
+    out.put<uint64_t>(dirs.size());
+    for (const dir_task &d : dirs) {
+        out.put(d.id);
+        out.put(d.path);
+        out.put(d.dev);
+    }
+    for (auto *groups : {&duplicates, &hardlinks}) {
+        out.put<uint64_t>(groups->size());
+        for (auto &g : *groups) out.put(g);
+    }
+    std::vector<uint32_t> linked, reps;
+    for (auto &l : links) {
+        linked.push_back(l.first);
+        reps.push_back(l.second);
+    }
+    out.put(linked);
+    out.put(reps);
+    /* what is written counts only once the checkpoint refers to it, a failed one is written again */
+    if (ok && out.commit()) {
+        QString written = (whole) ? QString("table in full")
+                                  : QString("%1 new, %2 changed").arg(files.files() - table_end.files).arg(changed.size());
+        if (whole) table_flags = files.flags;
+        for (uint32_t f : changed) table_flags[f] = files.flags[f];
+        table_flags.insert(table_flags.end(), files.flags.begin() + table_flags.size(), files.flags.end());
+        table_written(stamp, length);
+        emit console(QString("checkpoint saved (%1 files, %2)").arg(files.files()).arg(written), false, "gray");
+    } else {
+        /* the next one writes the table in full to the file the last good checkpoint does not use */
+        table_state = -1;
+        emit console("cannot save checkpoint", true, "orange");
     }
-    emit console("sorting files by hash..", false);
-    scanning_state = GROUP_DUPL;
 }
-void scantools::group_duplicates(size_t i0, size_t j0) {
-    emit console("grouping files (0%) ..", true);
-    for (size_t i = i0; i < files.size(); i++) {
-        if (files[i].skip) qDebug() << QString("skip ").append(files[i].path);
-        emit console(QString("grouping files (%1%) ..").arg((i + 1) * 100 / files.size()), false);
-        if (files[i].skip || files[i].hash == "" || files[i].duplicated) continue;
-        for (size_t j = std::max(j0, i + 1); j < files.size() && files[i].compare(files[j]); j++) {
-            check(i, j);
-            if (files[j].skip || files[j].duplicated) continue;
-            bool eq = true;
-            if (mode) {
-                QFile f1(files[i].path), f2(files[j].path);
-                std::vector<char> buffer1, buffer2;
-                if (!f1.exists() || !f1.open(QFile::ReadOnly)) files[i].skip = true;
-                if (!f2.exists() || !f2.open(QFile::ReadOnly)) files[j].skip = true;
-                if (files[i].skip || files[j].skip) continue;
-                while (!f1.atEnd()) {
-                    if (f1.read(&buffer1[0], BLOCK_SIZE) != BLOCK_SIZE) files[i].skip = true;
-                    if (f2.read(&buffer2[0], BLOCK_SIZE) != BLOCK_SIZE) files[i].skip = true;
-                    for (size_t k = 0; k < buffer1.size(); k++) {
-                        check(i, j);
-                        if (buffer1.at(k) != buffer2.at(k)) {
-                            eq = false;
-                            break;
-                        }
-                    }
-                    if (!eq) break;
-                }
+bool scantools::has_checkpoint() const {
+    checkpoint_reader in(checkpoint_path());
+    char magic[4];
+    uint32_t version;
+    return in.get(magic) && in.get(version) && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0
+            && version == CHECKPOINT_VERSION;
+}
+bool scantools::resume_checkpoint() {
+    if (main_state == SCANNING || main_state == PAUSED) return false;
+    checkpoint_reader in(checkpoint_path());
+    char magic[4];
+    uint32_t version, a;
+    uint8_t m;
+    int32_t state, stage;
+    uint64_t s0, s1, count;
+    bool ok = in.get(magic) && in.get(version) && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0
+            && version == CHECKPOINT_VERSION && in.get(a) && in.get(m) && in.get(state) && in.get(stage)
+            && in.get(s0) && in.get(s1) && in.get(count);
+    ok = ok && a <= BLAKE3 && hasher::available(static_cast<hash_algorithm>(a))
+            && state >= SCAN_DIRS && state < END && stage >= HEAD && stage <= FULL;
+    QStringList r;
+    for (uint64_t k = 0; ok && k < count; k++) {
+        std::string root;
+        ok = in.get(root);
+        r << QString::fromStdString(root);
+    }
+    uint64_t stamp = 0, length = 0;
+    ok = ok && in.get(stamp) && in.get(length) && in.get(count);
+    std::deque<dir_task> d;
+    for (uint64_t k = 0; ok && k < count; k++) {
+        dir_task task;
+        ok = in.get(task.id) && in.get(task.path) && in.get(task.dev);
+        d.push_back(std::move(task));
+    }
+    std::vector<std::vector<uint32_t>> groups[2];
+    for (auto &g : groups) {
+        ok = ok && in.get(count);
+        for (uint64_t k = 0; ok && k < count; k++) {
+            g.emplace_back();
+            ok = in.get(g.back());
+        }
+    }
+    std::vector<uint32_t> linked, reps;
+    ok = ok && in.get(linked) && in.get(reps) && linked.size() == reps.size() && in.finished();
+    /* the table as it was written in full, then every change the checkpoint covers */
+    file_table t;
+    uint64_t written;
+    checkpoint_reader table(table_path(stamp), length);
+    ok = ok && stamp > 0 && table.get(written) && written == stamp && t.load(table);
+    while (ok && !table.finished()) ok = t.load_changes(table);
+    for (size_t k = 0; ok && k < d.size(); k++) ok = d[k].id < t.dirs();
+    for (auto &g : groups) {
+        for (size_t k = 0; ok && k < g.size(); k++) {
+            for (uint32_t f : g[k]) ok = ok && f < t.files();
+        }
+    }
+    for (size_t k = 0; ok && k < linked.size(); k++) ok = linked[k] < t.files() && reps[k] < t.files();
+    if (!ok) {
+        emit console("cannot resume the previous scan, its checkpoint is damaged", true, "orange");
+        return false;
+    }
+    /* not clear(), the checkpoint stays until the next one replaces it */
+    stop_watching();
+    sizes.clear();
+    prehashed.clear();
+    links.clear();
+    if (algorithm != static_cast<hash_algorithm>(a)) cache.close();
+    algorithm = static_cast<hash_algorithm>(a);
+    mode = m;
+    roots = r;
+    files = std::move(t);
+    dirs = std::move(d);
+    duplicates = std::move(groups[0]);
+    hardlinks = std::move(groups[1]);
+    for (size_t k = 0; k < linked.size(); k++) links.push_back(std::make_pair(linked[k], reps[k]));
+    scanning_state = static_cast<decltype(scanning_state)>(state);
+    hash_stage = static_cast<hashing_stage>(stage);
+    saved0 = s0;
+    saved1 = s1;
+    table_flags = files.flags;
+    table_written(stamp, length);
+    memset(stats, 0, sizeof(stats));
+    main_state = PAUSED;
+    emit console(QString("previous scan of %1 restored at %2, %3 files").arg(roots.join(", "))
+                 .arg(STATE_NAMES[state]).arg(files.files()), true, "purple");
+    return true;
+}
+bool scantools::mark_candidates() {
+    /* hardlinks of one inode are hashed once: its first path stands for the others */
+    auto &o = files.order;
+    links.clear();
+    for (size_t b = 0, e; b < o.size(); b = e) {
+        e = b + 1;
+        while (e < o.size() && files.size[o[e]] == files.size[o[b]]) e++;
+        if (!sort_interruptible(o.begin() + b, o.begin() + e, [this](uint32_t f1, uint32_t f2) {
+            return files.inode_less(f1, f2);
+        }, [this]() { return interrupted(); })) return false;
+        size_t inodes = 0;
+        for (size_t k = b; k < e; k++) inodes += (k == b || !files.same_inode(o[k - 1], o[k]));
+        for (size_t k = b, rep = b; k < e; k++) {
+            bool linked = k > b && files.same_inode(o[k - 1], o[k]);
+            if (linked) {
+                links.push_back(std::make_pair(o[k], o[rep]));
+            } else {
+                rep = k;
             }
-            if (eq) {
-                if (!files[i].duplicated) {
-                    files[i].duplicated = true;
-                    duplicates.push_back(std::vector<file*>());
-                    duplicates.back().push_back(&files[i]);
+            files.set(o[k], file_table::LINKED, linked);
+            files.set(o[k], file_table::CANDIDATE, !linked && inodes > 1);
+            files.set(o[k], file_table::HASHED, false);
+        }
+    }
+    return true;
+}
+void scantools::propagate_links() {
+    /* hardlinks take over the result of their inode, inodes without
+     * a content duplicate are reported as hardlink sets of their own */
+    hardlinks.clear();
+    for (size_t k = 0; k < links.size(); k++) {
+        uint32_t f = links[k].first, rep = links[k].second;
+        files.hash[f] = files.hash[rep];
+        files.set(f, file_table::CANDIDATE, files.has(rep, file_table::CANDIDATE));
+        files.set(f, file_table::SKIP, files.has(rep, file_table::SKIP));
+        if (files.has(rep, file_table::CANDIDATE)) continue;
+        if (k == 0 || links[k - 1].second != rep) {
+            if (!hardlinks.empty()) stream_group(hardlinks.back(), true);
+            hardlinks.push_back(std::vector<uint32_t>(1, rep));
+        }
+        hardlinks.back().push_back(f);
+    }
+    if (!hardlinks.empty()) stream_group(hardlinks.back(), true);
+}
+void scantools::stream_group(const std::vector<uint32_t> &group, bool links) {
+    if (!streaming) return;
+    QStringList paths;
+    for (uint32_t f : group) paths << QFile::decodeName(files.path(f).c_str());
+    QString hash = (links) ? "" : QString::fromStdString(to_hex(files.hash[group[0]]));
+    emit group_found((links) ? "hardlink" : "duplicate", files.size[group[0]], hash, paths);
+}
+bool scantools::narrow_candidates(size_t &left) {
+    /* in each size group only files sharing their digest so far with another file stay candidates */
+    auto &o = files.order;
+    left = 0;
+    for (size_t b = 0, e; b < o.size(); b = e) {
+        e = b;
+        while (e < o.size() && files.size[o[e]] == files.size[o[b]]) e++;
+        if (hash_stage == FULL || files.size[o[b]] > PARTIAL_LIMIT) {
+            if (!sort_by_digest(o.data() + b, e - b, files.hash, [this]() { return interrupted(); })) return false;
+            for (size_t k = b; k < e;) {
+                size_t r = k, alive = 0;
+                while (r < e && files.hash[o[r]] == files.hash[o[k]]) alive += files.has(o[r++], file_table::CANDIDATE);
+                for (; k < r; k++) {
+                    if (alive > 1 || !files.has(o[k], file_table::CANDIDATE)) continue;
+                    files.set(o[k], file_table::CANDIDATE, false);
+                    files.hash[o[k]] = digest();
                 }
-                files[j].duplicated = true;
-                duplicates.back().push_back(&files[j]);
             }
-            j0 = 0; // it destroys any relations with saving state for next steps
+        }
+        for (size_t k = b; k < e; k++) left += files.has(o[k], file_table::CANDIDATE);
+    }
+    /* dropped files leave the working set, hardlinks stay to take over the result of their inode */
+    size_t kept = 0;
+    for (uint32_t f : o) {
+        files.set(f, file_table::HASHED, false);
+        if (files.has(f, file_table::CANDIDATE) || files.has(f, file_table::LINKED)) o[kept++] = f;
+    }
+    o.resize(kept);
+    return true;
+}
+bool scantools::sort_by_hash(size_t i0) {
+    emit console("sorting files by hash..", true);
+    auto &o = files.order;
+    progress.total = o.size();
+    for (size_t i = i0, e; i < o.size(); i = e) {
+        progress.items = i;
+        if (interrupted() || checkpoint_due()) return stop_at(i);
+        e = i + 1;
+        while (e < o.size() && files.size[o[e]] == files.size[o[i]]) e++;
+        if (e - i < 2) continue;
+        if (!sort_by_digest(o.data() + i, e - i, files.hash, [this]() { return interrupted(); })) return stop_at(i);
+    }
+    stats[SORT_HASH].items += o.size();
+    scanning_state = GROUP_DUPL;
+    return true;
+}
+bool scantools::group_duplicates(size_t i0) {
+    emit console("grouping files..", true);
+    content_comparer comparer;
+    comparer.set_governor(&governor);
+    auto stopped = [this]() { return interrupted(); };
+    auto &o = files.order;
+    progress.total = o.size();
+    /* unreadable files are counted, not listed: a line per file would drown the streamed groups */
+    size_t skipped = 0;
+    auto report_skipped = [this, &skipped]() {
+        if (skipped > 0) emit console(QString("grouping files: %1 files could not be read and were left out").arg(skipped), true, "orange");
+    };
+    for (size_t i = i0, e; i < o.size(); i = e) {
+        progress.items = i;
+        if (interrupted() || checkpoint_due()) {
+            report_skipped();
+            return stop_at(i);
+        }
+        e = i + 1;
+        if (files.has(o[i], file_table::SKIP) || !files.has(o[i], file_table::CANDIDATE)) continue;
+        while (e < o.size() && files.has(o[e], file_table::CANDIDATE) && files.same(o[i], o[e])) e++;
+        /* units are the distinct inodes of the group, each with all its paths */
+        std::sort(o.begin() + i, o.begin() + e, [this](uint32_t f1, uint32_t f2) {
+            return files.inode_less(f1, f2);
+        });
+        std::vector<size_t> units;
+        for (size_t k = i; k < e; k++) {
+            if (k == i || !files.same_inode(o[k - 1], o[k])) units.push_back(k);
+        }
+        units.push_back(e);
+        std::vector<std::vector<size_t>> classes;
+        if (mode) {
+            /* the whole hash group is verified byte by byte in one pass, one path per inode */
+            std::vector<std::string> paths;
+            for (size_t u = 0; u + 1 < units.size(); u++) paths.push_back(files.path(o[units[u]]));
+            std::vector<size_t> failed;
+            bool split = comparer.split(paths, files.size[o[i]], classes, failed, stopped);
+            stats[GROUP_DUPL].bytes += comparer.take_bytes();
+            if (!split) {
+                report_skipped();
+                return stop_at(i);
+            }
+            for (size_t u : failed) {
+                skipped += units[u + 1] - units[u];
+                for (size_t k = units[u]; k < units[u + 1]; k++) files.set(o[k], file_table::SKIP);
+            }
+        } else {
+            classes.emplace_back();
+            for (size_t u = 0; u + 1 < units.size(); u++) classes.back().push_back(u);
+        }
+        for (auto &c : classes) {
+            std::vector<uint32_t> group;
+            for (size_t u : c) {
+                for (size_t k = units[u]; k < units[u + 1]; k++) group.push_back(o[k]);
+            }
+            if (c.size() > 1) {
+                for (uint32_t f : group) files.set(f, file_table::DUPLICATED);
+                stream_group(group, false);
+                duplicates.push_back(std::move(group));
+            } else if (group.size() > 1) {
+                stream_group(group, true);
+                hardlinks.push_back(std::move(group));
+            }
         }
     }
-    emit console("grouping files..", false);
+    report_skipped();
+    stats[GROUP_DUPL].items += o.size();
     scanning_state = SORT_NAME;
+    return true;
 }
-void scantools::sort_by_name(size_t i0) {
+bool scantools::sort_by_name(size_t i0) {
     emit console("sorting files by name..", true);
+    progress.total = duplicates.size();
     for (size_t i = i0; i < duplicates.size(); i++) {
-        emit console(QString("sorting files by name (%1%) ..").arg((i + 1) * 100 / duplicates.size()), false);
-        check(i);
-        std::sort(duplicates[i].begin(), duplicates[i].end(), [&](const file *f1, const file *f2) {
-            check(i);
-            return f1->name < f2->name;
-        });
+        progress.items = i;
+        if (checkpoint_due()) return stop_at(i);
+        if (!sort_interruptible(duplicates[i].begin(), duplicates[i].end(), [this](uint32_t f1, uint32_t f2) {
+            return strcmp(files.name_of(f1), files.name_of(f2)) < 0;
+        }, [this]() { return interrupted(); })) return stop_at(i);
     }
-    emit console("sorting files by name..", false);
-    scanning_state = SHOW_RES;
+    stats[SORT_NAME].items += duplicates.size();
+    if (spilled) {
+        keep_batch();
+        scanning_state = SORT_SIZE;
+        return true;
+    }
+    scanning_state = FIND_SIMILAR;
+    return true;
 }
-void scantools::show_results(size_t i0, size_t j0) {
-    emit console("showing results..", true);
-    for (size_t i = i0; i < duplicates.size(); i++) {
-        emit console(QString("showing results (%1%) ..").arg((i + 1) * 100 / duplicates.size()), false);
-        for (size_t j = j0; j < duplicates[i].size(); j++) {
-            check(i, j);
-            auto &f = duplicates[i][j];
-            emit add_item(f->name, (j > 0) ? "DELETE" : "OK", QString::number(f->size), f->path, f->date.toString(FORMAT), (j > 0) ? &red_brush : nullptr);
-            j0 = 0; // it destroys any relations with saving state for next steps
+bool scantools::find_similar() {
+    if (similar_ratio <= 0) {
+        scanning_state = SHOW_RES;
+        return true;
+    }
+    /* one path per content: exact copies and hardlinks are reported already */
+    std::vector<uint8_t> copy(files.files(), 0);
+    for (auto &group : duplicates) {
+        for (size_t k = 1; k < group.size(); k++) copy[group[k]] = 1;
+    }
+    std::set<std::pair<uint64_t, uint64_t>> inodes;
+    std::vector<uint32_t> picked;
+    for (uint32_t f = 0; f < files.files(); f++) {
+        if (copy[f] || files.has(f, file_table::SKIP) || files.size[f] < SIMILAR_MIN_SIZE) continue;
+        if (inodes.insert(std::make_pair(files.dev[f], files.inode[f])).second) picked.push_back(f);
+    }
+    emit console(QString("cutting %1 files into chunks..").arg(picked.size()), true);
+    chunk_index index;
+    std::unique_ptr<read_engine> engine = create_engine();
+    std::atomic<uint64_t> &count = progress.items;
+    progress.total = picked.size();
+    progress.bytes = 0;
+    /* the index lives in memory only, a stopped analysis starts over */
+    auto stop = [&]() {
+        engine->cancel();
+        stats[FIND_SIMILAR].bytes += progress.bytes;
+        return stop_at(0);
+    };
+    for (uint32_t f : picked) {
+        read_job job;
+        job.path = files.path(f);
+        job.dev = files.dev[f];
+        job.offset = 0;
+        job.length = -1;
+        job.hash.reset(new chunk_sink(algorithm));
+        job.done = [&index, &count, f](bool ok, hasher &sink) {
+            if (ok) index.add(f, static_cast<chunk_sink &>(sink).take());
+            count++;
+        };
+        while (!engine->push(std::move(job), POLL_PERIOD)) {
+            if (interrupted()) return stop();
         }
-        emit add_item();
     }
-    emit update_items();
-    emit console("showing results..", false);
+    while (!engine->wait(POLL_PERIOD)) {
+        if (interrupted()) return stop();
+    }
+    stats[FIND_SIMILAR].items = picked.size();
+    stats[FIND_SIMILAR].bytes += progress.bytes;
+    index.match(files, similar_ratio, similar);
+    const uint64_t KiB = 1024;
+    emit console(QString("%1 files in %2 chunks, %3 KiB of them repeated, %4 pairs of similar files")
+                 .arg(similar.files).arg(similar.chunks).arg(similar.deduplicable() / KiB).arg(similar.pairs.size()), true, "gray");
+    for (size_t k = 0; k < similar.pairs.size() && k < SIMILAR_SHOWN; k++) {
+        auto &p = similar.pairs[k];
+        uint64_t smaller = static_cast<uint64_t>(std::min(files.size[p.a], files.size[p.b]));
+        emit console(QString("%1% of %2 KiB shared: %3 and %4").arg(p.shared * 100 / smaller).arg(smaller / KiB)
+                     .arg(QFile::decodeName(files.path(p.a).c_str())).arg(QFile::decodeName(files.path(p.b).c_str())), true, "gray");
+    }
+    scanning_state = SHOW_RES;
+    return true;
+}
+bool scantools::show_results() {
+    /* the views build their rows from the table itself, nothing is copied per file */
+    auto res = std::make_shared<scan_result>();
+    /* the table of a spilled scan holds the files of groups only, every directory would look copied */
+    if (matching_trees && !spilled) {
+        emit console("matching directory trees..", true);
+        match_trees(files, duplicates, hardlinks, algorithm, res->trees);
+        size_t collapsed = std::count(res->trees.collapsed.begin(), res->trees.collapsed.end(), 1);
+        emit console(QString("%1 groups of directories copied as a whole, %2 groups of files in them collapsed")
+                     .arg(res->trees.trees.size()).arg(collapsed), true, "gray");
+    }
+    count_deletable(res->trees);
+    report_memory();
+    report_page_cache();
+    stats[SHOW_RES].items = duplicates.size() + hardlinks.size();
+    res->files = std::move(files);
+    res->duplicates = std::move(duplicates);
+    res->hardlinks = std::move(hardlinks);
+    res->similar = std::move(similar);
+    files.clear();
+    duplicates.clear();
+    hardlinks.clear();
+    similar.clear();
+    bool partial = static_cast<bool>(spilled);
+    spilled.reset();
+    {
+        std::lock_guard<std::mutex> lg(result_lock);
+        last_result = std::move(res);
+    }
+    /* the watcher finds duplicates among the files it holds, a spilled result holds only grouped ones */
+    if (watching && partial) {
+        emit console("changes are not watched after a scan spilled to disk, its result has only the files of groups", true, "orange");
+    } else if (watching) {
+        start_watching();
+    }
+    emit results_ready(current_result());
     scanning_state = END;
+    return true;
+}
+void scantools::start_watching() {
+    std::unique_ptr<dup_watcher> w(new dup_watcher(algorithm, reader, governor.get_policy(), hash_threads));
+    w->set_filter(filter);
+    std::string error;
+    if (!w->start(*current_result(), [this](std::shared_ptr<const scan_result> r) {
+        emit console(QString("files changed: %1 duplicate groups, %2 hardlink sets").arg(r->duplicates.size()).arg(r->hardlinks.size()), true, "gray");
+        emit results_changed(std::move(r));
+    }, error)) {
+        emit console(QString("cannot watch for changes: %1").arg(QString::fromStdString(error)), true, "orange");
+        return;
+    }
+    emit console(QString("watching %1 directories for changes").arg(w->directories()), true, "gray");
+    std::lock_guard<std::mutex> lg(result_lock);
+    watcher = std::move(w);
+}
+void scantools::set_watching(bool watching) {
+    this->watching = watching;
+    if (!watching) stop_watching();
+}
+bool scantools::is_watching() const {
+    std::lock_guard<std::mutex> lg(result_lock);
+    return static_cast<bool>(watcher);
+}
+void scantools::stop_watching() {
+    /* the watcher is destroyed outside the lock, its thread may be publishing meanwhile */
+    std::unique_ptr<dup_watcher> w;
+    std::lock_guard<std::mutex> lg(result_lock);
+    w.swap(watcher);
+    if (w) last_result = w->current();
+}
+std::shared_ptr<const scan_result> scantools::current_result() const {
+    std::lock_guard<std::mutex> lg(result_lock);
+    return (watcher) ? watcher->current() : last_result;
+}
+void scantools::count_deletable(const tree_groups &trees) {
+    /* space comes back only when every link of an inode is deleted; kept copies of trees stay whole */
+    result = reclaimable = 0;
+    for (auto &group : duplicates) {
+        std::map<std::pair<uint64_t, uint64_t>, uint32_t> seen;
+        for (uint32_t f : group) {
+            if (files.same_inode(f, group[0]) || trees.copy_at(files.dir[f]) == tree_groups::KEPT) continue;
+            result++;
+            if (++seen[std::make_pair(files.dev[f], files.inode[f])] == files.nlink[f]) reclaimable += files.size[f];
+        }
+    }
+    emit console(QString("%1 files for deleting, %2 KiB can be freed, %3 hardlink sets")
+                 .arg(result).arg(reclaimable / 1024).arg(hardlinks.size()), true, "gray");
+}
+void scantools::report_memory() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    size_t groups = 0;
+    for (auto &d : duplicates) groups += d.capacity() * sizeof(uint32_t);
+    emit console(QString("peak memory %1 MiB, file table %2 MiB for %3 files, groups %4 KiB")
+                 .arg(usage.ru_maxrss / 1024).arg(files.memory() / (1024 * 1024)).arg(files.files()).arg(groups / 1024), true, "gray");
+}
+void scantools::report_page_cache() {
+    const uint64_t MiB = 1024 * 1024;
+    emit console(QString("page cache (%1): %2 MiB loaded, %3 MiB dropped again, %4 MiB were cached before, %5 MiB read directly")
+                 .arg(io_policy::name(governor.get_policy().cache)).arg(governor.get_loaded() / MiB)
+                 .arg(governor.get_dropped() / MiB).arg(governor.get_hits() / MiB).arg(governor.get_direct() / MiB), true, "gray");
+}
+
+const char *scantools::stage_name(int stage) {
+    return STATE_NAMES[stage];
+}
+
+QString scantools::progress_text() const {
+    int stage = progress.stage;
+    uint64_t items = progress.items, total = progress.total;
+    switch (stage) {
+        case SCAN_DIRS:
+            if (progress.bytes > 0) {
+                return QString("scanning directories (%1 directories, %2 files, %3 MiB hashed) ..")
+                        .arg(progress.dirs).arg(items).arg(progress.bytes / (1024 * 1024));
+            }
+            return QString("scanning directories (%1 directories, %2 files) ..").arg(progress.dirs).arg(items);
+        case CALC_HASH:
+            return QString("calculating hashes: %1 (%2 of %3, %4 MiB) ..").arg(STAGE_NAMES[progress.part])
+                    .arg(items).arg(total).arg(progress.bytes / (1024 * 1024));
+        case END:
+            return STATE_NAMES[END];
+        default:
+            return QString("%1 (%2%) ..").arg(STATE_NAMES[stage]).arg((total > 0) ? items * 100 / total : 0);
+    }
+}
+
+void scantools::set_hashing(size_t threads, size_t queue) {
+    hash_threads = (threads > 0) ? threads : QThread::idealThreadCount();
+    hash_queue = (queue > 0) ? queue : 4 * hash_threads;
+}
+
+void scantools::set_algorithm(hash_algorithm algorithm) {
+    if (!hasher::available(algorithm)) algorithm = hasher::best();
+    if (this->algorithm != algorithm) cache.close();
+    this->algorithm = algorithm;
+}
+
+void scantools::set_cache(bool enabled, size_t limit) {
+    caching = enabled;
+    if (limit > 0) cache.set_limit(limit);
+    if (!caching) cache.close();
+}
+
+void scantools::invalidate_cache() {
+    if (!cache.is_open()) cache.open(cache_path(), algorithm);
+    if (cache.invalidate()) {
+        emit console("hash cache cleared", true, "purple");
+    } else {
+        emit console("cannot clear hash cache", true, "orange");
+    }
+}
+
+void scantools::set_profiling(const QString &trace_path) {
+    this->trace_path = trace_path;
+}
+
+void scantools::write_trace() {
+    if (trace_path.isEmpty()) return;
+    if (profiler::write_trace(QFile::encodeName(trace_path).toStdString())) {
+        emit console(QString("trace written to ").append(trace_path), true, "gray");
+    } else {
+        emit console(QString("cannot write trace to ").append(trace_path), true, "orange");
+    }
+}
+
+void scantools::set_roots(const QStringList &roots) {
+    this->roots.clear();
+    for (const QString &r : roots) add_root(r);
+}
+void scantools::add_root(const QString &root) {
+    auto inside = [](const QString &path, const QString &dir) {
+        return path == dir || path.startsWith((dir.endsWith('/')) ? dir : dir + "/");
+    };
+    for (const QString &r : roots) {
+        if (inside(root, r)) return;
+    }
+    QStringList kept;
+    for (const QString &r : roots) {
+        if (!inside(r, root)) kept << r;
+    }
+    kept << root;
+    roots = kept;
+}
+bool scantools::set_device_limit(const QString &path, size_t limit) {
+    return devices.set(QFile::encodeName(path).toStdString(), limit);
 }
 
 void scantools::set_mode(bool mode) {
@@ -224,6 +1181,7 @@ void scantools::open_directory(QString path) {
         emit console(QString("cannot open ").append(path), true, "blue");
     } else {
         QDir::setCurrent(path);
+        roots = QStringList(QDir::currentPath());
         emit clear_items();
         QFileInfoList list = QDir::current().entryInfoList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files);
         std::stable_sort(list.begin(), list.end(), [](const QFileInfo &f1, const QFileInfo &f2) {
@@ -240,33 +1198,27 @@ void scantools::open_directory(QString path) {
     }
 }
 
-void scantools::select_item(QTreeWidgetItem *item, QString (*get_state)(const QTreeWidgetItem &item), void (*change_state)(QTreeWidgetItem &item, QString value)) {
-    if (get_state(*item) == "OK") {
-        change_state(*item, "DELETE");
-        emit color_item(item, &red_brush);
-        result++;
-    } else if (get_state(*item) == "DELETE") {
-        change_state(*item, "OK");
-        emit color_item(item, &black_brush);
-        result--;
-    } else return;
-}
-
-size_t scantools::delete_files(QTreeWidgetItemIterator it, QString (*get_state)(const QTreeWidgetItem &item), QString (*get_path)(const QTreeWidgetItem &item)) {
-    size_t count = 0;
-    emit console("deleting files (0%) ..", true, "red");
-    while (*it) {
-        if (get_state(*(*it)) == "DELETE") {
-            emit console(QString("deleting files (%1%) ..").arg(count * 100 / result), false, "red");
-            QFile file(get_path(*(*it)));
-            if (!file.exists()) continue;
-            if (file.remove()) {
-                count++;
-            } else {
-                emit console(QString("cannot delete ").append(get_path(*(*it))), false, "orange");
-            }
-        }
-        ++it;
+reclaimer::report scantools::reclaim(const scan_result &result, const std::vector<std::pair<uint32_t, uint32_t>> &plan,
+                                     reclaimer::action act) {
+    const file_table &t = result.files;
+    std::vector<reclaim_item> items;
+    for (auto &p : plan) {
+        uint32_t f = p.first, k = p.second;
+        if (t.same_inode(f, k)) continue;
+        items.push_back({t.path(f), t.size[f], t.mtime[f], t.dev[f], t.inode[f], t.nlink[f], t.path(k), t.mtime[k], t.dev[k], t.inode[k]});
     }
-    return count;
+    QString verb = (act == reclaimer::DELETE) ? "deleting files" : QString("replacing files with %1s").arg(reclaimer::name(act));
+    emit console(QString("%1 (0%) ..").arg(verb), true, "red");
+    reclaimer r(act, hash_threads);
+    /* cancel stops it between files, what was done stays done */
+    request = NONE;
+    reclaimer::report rep = r.run(items, [this]() { return interrupted(); }, [this, &verb](size_t done, size_t total) {
+        emit console(QString("%1 (%2%) ..").arg(verb).arg((total > 0) ? done * 100 / total : 100), false, "red");
+    });
+    emit console(QString("%1: %2 done, %3 changed since the scan and left alone, %4 failed, %5 KiB freed")
+                 .arg(verb).arg(rep.done).arg(rep.changed).arg(rep.failed).arg(rep.bytes / 1024), true, "red");
+    if (rep.left > 0) emit console(QString("%1 stopped, %2 files left as they were").arg(verb).arg(rep.left), true, "orange");
+    for (auto &e : rep.errors) emit console(QString::fromStdString(e), true, "orange");
+    request = NONE;
+    return rep;
 }
@@ -1,60 +1,51 @@
 #ifndef SCANTOOLS_H
 #define SCANTOOLS_H
 
+#include "dirwalker.h"
+#include "readengine.h"
+#include "devices.h"
+#include "hasher.h"
+#include "hashcache.h"
+#include "filetable.h"
+#include "sizeindex.h"
+#include "treematch.h"
+#include "chunker.h"
+#include "watcher.h"
+#include "reclaimer.h"
+#include "spill.h"
+
+#include <QFile>
 #include <QFileInfo>
 #include <QDebug>
 #include <QString>
-#include <queue>
+#include <QStringList>
+#include <QObject>
+#include <QMetaType>
+#include <deque>
 #include <vector>
-#include <QTreeWidget>
+#include <memory>
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <QDateTime>
 #include <QDir>
 
-static QColor red = QColor(255, 0, 0);
-static QColor black = QColor(0, 0, 0);
-static QBrush red_brush = QBrush(red);
-static QBrush black_brush = QBrush(black);
-
-struct file {
-    QString name;
-    QString path;
-    long long size;
-    QDateTime date;
-
-    bool skip;
-    bool duplicated;
-    size_t first;
-    QString hash;
-
-    file(QFileInfo &file_info) {
-        name = file_info.fileName();
-        path = file_info.filePath();
-        size = file_info.size();
-        date = file_info.lastModified();
-        skip = !file_info.isReadable();
-        duplicated = false;
-        hash = "";
-    }
-    bool compare(file &another) {
-        return size == another.size && hash == another.hash;
-    }
+/* everything a finished scan found, handed over to the views as a whole */
+struct scan_result {
+    file_table files;
+    std::vector<std::vector<uint32_t>> duplicates; // first inode of a group is the kept one
+    std::vector<std::vector<uint32_t>> hardlinks;
+    tree_groups trees;                             // copied directories, groups inside them are collapsed
+    similar_files similar;                         // empty unless similar files were looked for
 };
+Q_DECLARE_METATYPE(std::shared_ptr<const scan_result>)
 
-class cancel_exception : public std::exception {
-    const char* what () const throw () { return "Cancel"; }
-};
+/* written by the scanning thread, sampled by the views on a timer instead of a signal per item */
+struct scan_progress {
+    std::atomic<int> stage, part;
+    std::atomic<uint64_t> dirs, items, total, bytes;
 
-class pause_exception : public std::exception {
-private:
-    size_t data[2];
-public:
-    pause_exception(size_t i = 0, size_t j = 0) {
-        data[0] = i; data[1] = j;
-    }
-    size_t get(size_t i) {
-        return data[i];
-    }
-    const char* what () const throw () { return "Pause"; }
+    scan_progress() : stage(0), part(0), dirs(0), items(0), total(0), bytes(0) {}
 };
 
 class unknown_exception : public std::exception {
@@ -70,10 +61,14 @@ signals:
     void canceled();
     void finished();
     void console(QString text, bool save, QString color = "");
-    void add_item(QString s1 = "", QString s2 = "", QString s3 = "", QString s4 = "", QString s5 = "", QBrush *brush = nullptr);
-    void color_item(QTreeWidgetItem *item, QBrush *brush);
+    void add_item(QString s1 = "", QString s2 = "", QString s3 = "", QString s4 = "", QString s5 = "", bool marked = false);
     void clear_items();
+    /* emitted as soon as a group is final, only with streaming on; kind is "duplicate" or "hardlink" */
+    void group_found(QString kind, qint64 size, QString hash, QStringList paths);
     void update_items();
+    void results_ready(std::shared_ptr<const scan_result> result);
+    /* emitted from the watching thread after files changed, only with watching on */
+    void results_changed(std::shared_ptr<const scan_result> result);
 
 public slots:
     void start();
@@ -82,28 +77,131 @@ private:
     /* we can use it in any part of code */
     bool mode;
     size_t result;
-    QString main_directory;
-    enum {SCAN_DIRS, SORT_SIZE, CALC_HASH, SORT_HASH, GROUP_DUPL, SORT_NAME, SHOW_RES, END} scanning_state;
-    enum {PREPARED, SCANNING, PAUSED, CANCELED, FINISHED} main_state;
+    long long reclaimable;
+    size_t hash_threads, hash_queue;
+    read_engine::kind reader;
+    bool scheduling;
+    device_limits devices;
+    walk_filter filter;
+    uint64_t rejected[walk_filter::REASONS];    // by the walks of this scan
+    io_governor governor;
+    hash_algorithm algorithm;
+    bool caching;
+    hash_cache cache;
+    bool streaming;
+    bool pipelined;
+    bool watching;
+    bool matching_trees;
+    double similar_ratio;                       // 0 turns the chunk analysis off
+    size_t memory_budget;                       // bytes of file records, 0 for no limit
+    int checkpoint_period;                      // seconds, 0 turns checkpoints off
+    std::atomic<int64_t> checkpoint_at;         // steady clock milliseconds
+    /* the table has a file of its own, written in full once per stage; later checkpoints of the
+     * stage append what changed and record how much of the file they cover */
+    uint64_t table_stamp;                       // full writes so far, 0 if none
+    uint64_t table_length;
+    int table_state, table_hash_stage;          // the stage the file was written in full
+    file_table::extent table_end;
+    std::vector<uint8_t> table_flags;           // as in the file
+    size_t table_order;                         // the working set in the file is current up to here
+    QString trace_path;
+    QStringList roots;
+    enum {SCAN_DIRS, SORT_SIZE, CALC_HASH, SORT_HASH, GROUP_DUPL, SORT_NAME, FIND_SIMILAR, SHOW_RES, END} scanning_state;
+    enum main_states {PREPARED, SCANNING, PAUSED, CANCELED, FINISHED};
+    std::atomic<main_states> main_state;
+    /* set by the controlling thread, the scanning one looks at it at safe points only */
+    enum requests {NONE, PAUSE, CANCEL};
+    std::atomic<requests> request;
+    scan_progress progress;
+    enum hashing_stage {HEAD, TAIL, MIDDLE, FULL} hash_stage;
 
     /* we can use it only in while-switch block in start */
     size_t saved0, saved1;
-    std::vector<file> files;
-    std::queue<QString> dirs;
-    std::vector<std::vector<file*>> duplicates;
+    file_table files;
+    std::deque<dir_task> dirs;
+    std::vector<std::vector<uint32_t>> duplicates;
+    std::vector<std::vector<uint32_t>> hardlinks;
+    std::vector<std::pair<uint32_t, uint32_t>> links; // hardlink and the path hashed for its inode
+    similar_files similar;
+
+    /* external mode: the walk took more than the budget and was spilled to disk, files of shared
+     * sizes are read back in batches and each batch goes through the stages up to sorting by name */
+    struct spilled_scan {
+        spill_store store;
+        bool loaded = false;                    // a batch is in files
+        size_t batches = 0;
+        file_table groups;                      // files of the groups of finished batches, directories are those of files
+        std::vector<std::vector<uint32_t>> duplicates, hardlinks;  // ids in groups
+
+        explicit spilled_scan(const std::string &directory) : store(directory) {}
+    };
+    std::unique_ptr<spilled_scan> spilled;
+
+    /* pipelined mode: first digests of inodes hashed while the walk was running */
+    struct prehash {
+        int stage;
+        bool done;
+        digest d;
+    };
+    size_index sizes;
+    std::mutex prehash_lock;
+    std::map<std::pair<uint64_t, uint64_t>, prehash> prehashed;
+
+    /* the result of the last finished scan, kept up to date by the watcher while watching */
+    mutable std::mutex result_lock;
+    std::shared_ptr<const scan_result> last_result;
+    std::unique_ptr<dup_watcher> watcher;
 
     /* parts of scanning */
-    void scan_directories(size_t);
-    void sort_by_size();
-    void calculate_hashes(size_t, size_t);
-    void sort_by_hash(size_t);
-    void group_duplicates(size_t, size_t);
-    void sort_by_name(size_t);
-    void show_results(size_t i0, size_t j0);
+    /* each returns false when interrupted, with the point to resume from in saved0 and saved1 */
+    bool scan_directories();
+    bool sort_by_size();
+    bool start_spilled();
+    bool load_batch();
+    void keep_batch();
+    bool finish_batches();
+    bool calculate_hashes(size_t);
+    bool mark_candidates();
+    void propagate_links();
+    std::unique_ptr<read_engine> create_engine();
+    void report_devices();
+    void prehash_file(read_engine &engine, std::string &&path, const struct stat &st);
+    bool take_prehashed(uint32_t file);
+    bool narrow_candidates(size_t &left);
+    bool sort_by_hash(size_t);
+    bool group_duplicates(size_t);
+    bool sort_by_name(size_t);
+    bool find_similar();
+    bool show_results();
 
     /* service */
-    void check(size_t i = 0, size_t j = 0);
+    bool interrupted() const;
+    /* asked only where a stop keeps the work done so far, a stage stopped for it just goes on */
+    bool checkpoint_due() const;
+    bool stop_at(size_t i, size_t j = 0);
+    void schedule_checkpoint();
+    void save_checkpoint();
+    size_t changed_order() const;
+    void table_written(uint64_t stamp, uint64_t length);
     void clear();
+    void save_cache();
+    void count_deletable(const tree_groups &trees);
+    void stream_group(const std::vector<uint32_t> &group, bool links);
+    void report_memory();
+    void report_page_cache();
+    void start_watching();
+    void write_trace();
+
+public:
+    /* totals of the last scan for one stage, kept until the next scan starts */
+    struct stage_stats {
+        qint64 nanoseconds;
+        uint64_t items, bytes;
+    };
+    static const int STAGES = 8;
+
+private:
+    stage_stats stats[STAGES];
 
 public:
     /* standard methods */
@@ -111,21 +209,76 @@ public:
     ~scantools() = default;
 
     /* changing methods */
-    void pause() { this->main_state = PAUSED; }
-    void cancel() { this->main_state = CANCELED; }
+    /* both are safe to call from any thread, the scan stops within a few milliseconds */
+    void pause();
+    void cancel();
     void set_mode(bool mode);
+    void set_hashing(size_t threads, size_t queue = 0);
+    /* how file contents are read for hashing, io_uring falls back to pread where it is missing */
+    void set_reader(read_engine::kind reader) { this->reader = reader; }
+    /* walking and reading are limited per device: one reader for a spinning disk, a few for a network
+     * share, flash gets all threads; without it every device shares one engine */
+    void set_scheduling(bool scheduling) { this->scheduling = scheduling; }
+    /* files of the device path is on are listed and read by at most limit threads, 0 for no limit */
+    bool set_device_limit(const QString &path, size_t limit);
+    /* page cache use and bandwidth cap of content reads, takes effect with the next stage */
+    void set_io_policy(const io_policy &policy) { governor.set_policy(policy); }
+    void set_algorithm(hash_algorithm algorithm);
+    void set_cache(bool enabled, size_t limit = 0);
+    void invalidate_cache();
+    /* roots inside another root are dropped, their files would be found twice */
+    void set_roots(const QStringList &roots);
+    void add_root(const QString &root);
+    const QStringList &get_roots() const { return roots; }
+    void set_streaming(bool streaming) { this->streaming = streaming; }
+    /* hash files of shared sizes while the walk is still running */
+    void set_pipelined(bool pipelined) { this->pipelined = pipelined; }
+    /* sizes, patterns, hidden entries and mount points the walk leaves out, for the next scan */
+    void set_filter(const walk_filter &filter) { this->filter = filter; }
+    /* finished scans report directories copied as a whole once, instead of a group per file in them */
+    void set_trees(bool matching_trees) { this->matching_trees = matching_trees; }
+    /* files are also cut into content-defined chunks, pairs sharing at least ratio of the smaller
+     * file are reported; every file but exact copies is read once more, 0 turns it off */
+    void set_similar(double ratio) { similar_ratio = ratio; }
+    /* file records of a scan take about this many bytes at most: beyond it the walk is spilled to
+     * temporary files and only files of shared sizes are read back, in batches of that size; directories
+     * stay in memory, directory trees and similar files are not looked for, no checkpoint is kept
+     * and changes are not watched. 0 for no limit */
+    void set_memory_budget(size_t bytes) { memory_budget = bytes; }
+    /* the state of a running scan is saved this often and on pause, so it survives an exit or a crash */
+    void set_checkpointing(int seconds) { checkpoint_period = seconds; }
+    bool has_checkpoint() const;
+    /* after a scan finishes its directories are watched and the duplicates are updated as files change */
+    void set_watching(bool watching);
+    void stop_watching();
+    /* loads the scan a previous run left behind as a paused one, start goes on from there */
+    bool resume_checkpoint();
+    /* with a non-empty path every scan is profiled and a Chrome trace is written there */
+    void set_profiling(const QString &trace_path);
     void open_directory(QString path = QDir::currentPath());
-    void select_item(QTreeWidgetItem *item, QString (*get_state)(const QTreeWidgetItem &item), void (*change_state)(QTreeWidgetItem &item, QString value));
-    size_t delete_files(QTreeWidgetItemIterator it, QString (*get_state)(const QTreeWidgetItem &item), QString (*get_path)(const QTreeWidgetItem &item));
+    /* frees the space of duplicates of a result, each given with the file of its group that stays;
+     * runs on worker threads and can be called from any thread once the scan is over */
+    reclaimer::report reclaim(const scan_result &result, const std::vector<std::pair<uint32_t, uint32_t>> &plan,
+                              reclaimer::action act);
 
     /* describing methods */
     bool is_mode() { return mode; }
+    hash_algorithm get_algorithm() { return algorithm; }
     bool is_prepared() { return main_state == PREPARED; }
     bool is_scanning() { return main_state == SCANNING; }
     bool is_paused() { return main_state == PAUSED; }
     bool is_canceled() { return main_state == CANCELED; }
     bool is_finished() { return main_state == FINISHED; }
     size_t number_for_deleting() { return (is_finished()) ? result : 0; }
+    long long bytes_for_deleting() { return (is_finished()) ? reclaimable : 0; }
+    /* true while a watcher keeps the last result up to date */
+    bool is_watching() const;
+    /* the duplicates as they are now, without a scan; empty before the first scan finished */
+    std::shared_ptr<const scan_result> current_result() const;
+    QString progress_text() const;
+    static const char *stage_name(int stage);
+    const stage_stats &get_stats(int stage) const { return stats[stage]; }
+    uint64_t get_rejected(walk_filter::reason r) const { return rejected[r]; }
 };
 
 #endif // SCANTOOLS_H
@@ -0,0 +1,27 @@
+#include "sizeindex.h"
+
+void size_index::add(int64_t size, file_ref &&file, std::vector<file_ref> &candidates) {
+    shard &s = shards[static_cast<uint64_t>(size) * 0x9E3779B97F4A7C15ULL >> 58];
+    std::lock_guard<std::mutex> lg(s.lock);
+    auto it = s.sizes.find(size);
+    if (it == s.sizes.end()) {
+        s.sizes.emplace(size, entry{std::move(file), false});
+        return;
+    }
+    entry &e = it->second;
+    if (!e.shared) {
+        /* another path of the same inode is a hardlink, not a reason to hash */
+        if (e.first.dev == file.dev && e.first.inode == file.inode) return;
+        e.shared = true;
+        candidates.push_back(std::move(e.first));
+        e.first = file_ref();
+    }
+    candidates.push_back(std::move(file));
+}
+
+void size_index::clear() {
+    for (shard &s : shards) {
+        std::lock_guard<std::mutex> lg(s.lock);
+        s.sizes.clear();
+    }
+}
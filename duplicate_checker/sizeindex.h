@@ -0,0 +1,39 @@
+#ifndef SIZEINDEX_H
+#define SIZEINDEX_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+/* concurrent index of file sizes seen by the walk so far; tells which files became
+ * hashing candidates, so hashing can start before the walk is over */
+class size_index {
+public:
+    struct file_ref {
+        std::string path;
+        uint64_t dev, inode;
+        int64_t mtime;
+    };
+
+private:
+    struct entry {
+        file_ref first;           // kept until a second inode of this size shows up
+        bool shared;
+    };
+    struct shard {
+        std::mutex lock;
+        std::unordered_map<int64_t, entry> sizes;
+    };
+    static const size_t SHARDS = 64;
+    shard shards[SHARDS];
+
+public:
+    /* appends to candidates the files that need hashing now: nothing for the first
+     * inode of a size, both files for the second one and the file alone after that */
+    void add(int64_t size, file_ref &&file, std::vector<file_ref> &candidates);
+    void clear();
+};
+
+#endif // SIZEINDEX_H
@@ -0,0 +1,163 @@
+#include "spill.h"
+#include "radix.h"
+
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t WRITE_BUFFER = 1024 * 1024;
+const size_t READ_BUFFER = 256 * 1024;  // per run, all runs are read at once
+/* size, mtime, dev, inode, nlink, dir and the length of the name that follows */
+const size_t HEADER = 4 * sizeof(int64_t) + 2 * sizeof(uint32_t) + sizeof(uint16_t);
+
+template <typename T>
+static void put(std::vector<char> &out, const T &value) {
+    const char *p = reinterpret_cast<const char *>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+static const char *get(const char *in, T &value) {
+    memcpy(&value, in, sizeof(T));
+    return in + sizeof(T);
+}
+
+spill_store::run::~run() {
+    if (fd >= 0) close(fd);
+}
+
+spill_store::spill_store(const std::string &directory) : directory(directory), records(0), bytes(0) {}
+
+bool spill_store::write(int fd, const std::vector<char> &data, uint64_t &offset) {
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = pwrite(fd, data.data() + done, data.size() - done, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+        offset += n;
+    }
+    return true;
+}
+
+bool spill_store::spill(const file_table &table) {
+    {
+        std::lock_guard<std::mutex> lg(lock);
+        if (!error.empty()) return false;
+    }
+    std::vector<uint32_t> ids(table.files());
+    std::iota(ids.begin(), ids.end(), 0);
+    radix_sort(ids.data(), ids.size(), [&table](uint32_t f) {
+        return static_cast<uint64_t>(table.size[f]);
+    }, []() { return false; });
+    std::string name = directory + "/duplicate_checker.XXXXXX";
+    std::unique_ptr<run> r(new run());
+    r->fd = mkostemp(&name[0], O_CLOEXEC);
+    if (r->fd >= 0) unlink(name.c_str());
+    bool ok = r->fd >= 0;
+    std::vector<char> out;
+    out.reserve(WRITE_BUFFER + HEADER + UINT16_MAX);
+    for (size_t k = 0; ok && k < ids.size(); k++) {
+        uint32_t f = ids[k];
+        const char *n = table.name_of(f);
+        uint16_t length = static_cast<uint16_t>(strlen(n));
+        put(out, table.size[f]);
+        put(out, table.mtime[f]);
+        put(out, table.dev[f]);
+        put(out, table.inode[f]);
+        put(out, table.nlink[f]);
+        put(out, table.dir[f]);
+        put(out, length);
+        out.insert(out.end(), n, n + length);
+        if (out.size() < WRITE_BUFFER && k + 1 < ids.size()) continue;
+        ok = write(r->fd, out, r->end);
+        out.clear();
+    }
+    std::lock_guard<std::mutex> lg(lock);
+    if (!ok) {
+        if (error.empty()) error = std::string("cannot write a run to ") + directory + ": " + strerror(errno);
+        return false;
+    }
+    records += ids.size();
+    bytes += r->end;
+    runs.push_back(std::move(r));
+    return true;
+}
+
+bool spill_store::read(run &r) {
+    /* what is left of the buffer moves to its front and the run is read on after it */
+    auto fill = [&r, this](size_t need) {
+        if (r.filled - r.at >= need) return true;
+        memmove(r.buffer.data(), r.buffer.data() + r.at, r.filled - r.at);
+        r.filled -= r.at;
+        r.at = 0;
+        while (r.filled < need && r.offset < r.end) {
+            size_t want = static_cast<size_t>(std::min<uint64_t>(r.buffer.size() - r.filled, r.end - r.offset));
+            ssize_t n = pread(r.fd, r.buffer.data() + r.filled, want, r.offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                error = std::string("cannot read a run back: ") + ((n < 0) ? strerror(errno) : "it is cut short");
+                return false;
+            }
+            r.filled += n;
+            r.offset += n;
+        }
+        return r.filled >= need;
+    };
+    if (r.at == r.filled && r.offset == r.end) {
+        /* the run is over, its memory and file go */
+        r.buffer = std::vector<char>();
+        close(r.fd);
+        r.fd = -1;
+        return false;
+    }
+    uint16_t length;
+    if (!fill(HEADER)) {
+        if (error.empty()) error = "cannot read a run back: it is cut short";
+        return false;
+    }
+    const char *p = r.buffer.data() + r.at;
+    p = get(p, r.head.size);
+    p = get(p, r.head.mtime);
+    p = get(p, r.head.dev);
+    p = get(p, r.head.inode);
+    p = get(p, r.head.nlink);
+    p = get(p, r.head.dir);
+    get(p, length);
+    r.at += HEADER;
+    if (!fill(length)) {
+        if (error.empty()) error = "cannot read a run back: it is cut short";
+        return false;
+    }
+    r.head.name.assign(r.buffer.data() + r.at, length);
+    r.at += length;
+    return true;
+}
+
+bool spill_store::start_merge() {
+    for (size_t k = 0; k < runs.size(); k++) {
+        run &r = *runs[k];
+        r.buffer.resize(READ_BUFFER);
+        if (read(r)) heads.push(std::make_pair(r.head.size, k));
+        if (failed()) return false;
+    }
+    return true;
+}
+
+bool spill_store::next_group(std::vector<record> &group) {
+    while (!heads.empty()) {
+        group.clear();
+        int64_t size = heads.top().first;
+        while (!heads.empty() && heads.top().first == size) {
+            size_t k = heads.top().second;
+            heads.pop();
+            run &r = *runs[k];
+            group.push_back(std::move(r.head));
+            if (read(r)) heads.push(std::make_pair(r.head.size, k));
+            if (failed()) return false;
+        }
+        if (group.size() > 1) return true;
+    }
+    return false;
+}
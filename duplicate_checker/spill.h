@@ -0,0 +1,70 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include "filetable.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <functional>
+#include <cstdint>
+
+/* files of a walk too big for memory, written out in runs sorted by size and read back
+ * with a k-way merge, one size at a time; a record holds the directory id, so the
+ * directories stay in the table and a file is a few dozen bytes on disk. Runs are
+ * temporary files unlinked as soon as they are created, nothing is left after a crash */
+class spill_store {
+public:
+    struct record {
+        int64_t size, mtime;
+        uint64_t dev, inode;
+        uint32_t nlink, dir;
+        std::string name;
+    };
+
+private:
+    struct run {
+        int fd;
+        uint64_t offset, end;         // of the next byte to read and of the run
+        std::vector<char> buffer;
+        size_t at, filled;
+        record head;                  // the smallest record not yet handed out
+
+        run() : fd(-1), offset(0), end(0), at(0), filled(0) {}
+        ~run();
+    };
+    typedef std::pair<int64_t, size_t> head_ref;    // size and run
+
+    std::string directory;
+    std::mutex lock;
+    std::vector<std::unique_ptr<run>> runs;
+    std::priority_queue<head_ref, std::vector<head_ref>, std::greater<head_ref>> heads;
+    uint64_t records, bytes;
+    std::string error;            // the first failure, no run is added after it
+
+    bool write(int fd, const std::vector<char> &data, uint64_t &offset);
+    bool read(run &r);
+
+public:
+    /* runs are created in directory */
+    explicit spill_store(const std::string &directory);
+
+    /* writes the files of table as a new run, sorted by size; safe to call from several threads,
+     * false if it failed, the table is then not written out and has to stay in memory */
+    bool spill(const file_table &table);
+    /* no run can be added once the merge started; false if a run cannot be read */
+    bool start_merge();
+    /* the files of the next size shared by more than one file, sizes of a single file are
+     * passed over; false when every run is read or one failed */
+    bool next_group(std::vector<record> &group);
+
+    size_t run_count() const { return runs.size(); }
+    uint64_t record_count() const { return records; }
+    uint64_t byte_count() const { return bytes; }
+    bool failed() const { return !error.empty(); }
+    const std::string &get_error() const { return error; }
+};
+
+#endif // SPILL_H
@@ -0,0 +1,102 @@
+#include "filetable.h"
+#include "checkpoint.h"
+
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <QFile>
+
+#include <cstdio>
+#include <cstring>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+}
+
+/* a table as sort_by_size leaves it: unique sizes are out of the working set */
+static file_table shrunk_table() {
+    file_table t;
+    uint32_t root = t.add_dir(file_table::NO_DIR, "/r", 2);
+    uint32_t sub = t.add_dir(root, "sub", 3);
+    const char *names[] = {"a", "b", "c", "d", "e"};
+    const int64_t sizes[] = {10, 20, 10, 30, 20};
+    for (int k = 0; k < 5; k++) {
+        t.add_file((k % 2) ? sub : root, t.intern(names[k], 1), sizes[k], k, 1, 100 + k, 1);
+    }
+    t.order = {0, 2, 1, 4};
+    return t;
+}
+
+static void test_shrunk_order_round_trip(const std::string &path) {
+    file_table t = shrunk_table();
+    checkpoint_writer out(path);
+    t.save(out);
+    check(out.commit(), "a table with a shrunk working set is saved");
+    file_table u;
+    checkpoint_reader in(path);
+    check(u.load(in) && in.finished(), "a table with a shrunk working set is loaded");
+    check(u.files() == 5 && u.dirs() == 2, "every file and directory comes back");
+    check(u.order == t.order, "the working set comes back as it was");
+    check(u.path(3) == "/r/sub/d", "paths come back");
+}
+
+static void test_bad_order_rejected(const std::string &path) {
+    file_table t = shrunk_table();
+    t.order.back() = 5;
+    checkpoint_writer out(path);
+    t.save(out);
+    check(out.commit(), "a damaged table is saved");
+    file_table u;
+    checkpoint_reader in(path);
+    check(!u.load(in) && u.files() == 0, "a working set naming a file past the columns is rejected");
+}
+
+static void test_changes_appended(const std::string &path) {
+    /* a walk adds files, a later stage changes some of the working set */
+    file_table t = shrunk_table();
+    checkpoint_writer out(path);
+    t.save(out);
+    uint64_t length = out.position();
+    check(out.commit(), "the table is written in full");
+    file_table::extent from = t.end();
+    uint32_t sub = t.add_dir(1, "deeper", 6);
+    uint32_t added = t.add_file(sub, t.intern("f", 1), 40, 5, 1, 105, 1);
+    check(added == 5 && t.order.back() == added, "a file added after the working set shrank joins it under its own id");
+    t.set(0, file_table::HASHED);
+    t.hash[0][0] = 7;
+    std::swap(t.order[1], t.order[2]);
+    checkpoint_writer more(path, length);
+    more.put<uint64_t>(99);
+    check(more.commit(), "a failed append is written");
+    checkpoint_writer again(path, length);
+    t.save_changes(again, from, {0}, 1, t.order.size());
+    uint64_t end = again.position();
+    check(again.commit(), "the changes are appended in place of it");
+    file_table u;
+    checkpoint_reader in(path, end);
+    check(u.load(in) && u.load_changes(in) && in.finished(), "the table and its changes are loaded");
+    check(u.files() == 6 && u.dirs() == 3 && u.path(5) == "/r/sub/deeper/f", "added files and directories come back");
+    check(u.has(0, file_table::HASHED) && u.hash[0] == t.hash[0], "changed files come back changed");
+    check(u.order == std::vector<uint32_t>({0, 1, 2, 4, 5}), "the working set comes back as it was changed");
+    file_table v;
+    checkpoint_reader before(path, length);
+    check(v.load(before) && before.finished() && v.files() == 5, "the table in full is still there on its own");
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "cannot create a temporary directory\n");
+        return 2;
+    }
+    std::string path = QFile::encodeName(dir.filePath("table.checkpoint")).toStdString();
+    test_shrunk_order_round_trip(path);
+    test_bad_order_rejected(path);
+    test_changes_appended(path);
+    if (failures == 0) printf("all tests passed\n");
+    return (failures == 0) ? 0 : 1;
+}
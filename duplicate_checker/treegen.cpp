@@ -0,0 +1,148 @@
+#include "treegen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+const size_t WRITE_BLOCK = 64 * 1024;
+const int64_t HEAD_SIZE = 4 * 1024;
+
+struct generated_file {
+    std::string path;
+    int64_t size;
+    uint64_t head, body;            // seeds of the first 4 KiB and of the rest
+};
+
+static uint64_t next(uint64_t &x) {
+    /* xorshift64*, fast enough to keep the disk busy */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    return x * 2685821657736338717ULL;
+}
+
+static void fill(char *buffer, size_t length, uint64_t &x) {
+    for (size_t k = 0; k < length; k += sizeof(uint64_t)) {
+        uint64_t v = next(x);
+        memcpy(buffer + k, &v, std::min(sizeof(v), length - k));
+    }
+}
+
+static bool write_file(const generated_file &f, std::vector<char> &buffer, std::string &error) {
+    int fd = open(f.path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = f.path + ": " + strerror(errno);
+        return false;
+    }
+    uint64_t head = f.head | 1, body = f.body | 1;
+    bool ok = true;
+    for (int64_t offset = 0; offset < f.size && ok;) {
+        /* the head block is cut at HEAD_SIZE so files sharing it differ right after */
+        int64_t limit = (offset < HEAD_SIZE) ? std::min(HEAD_SIZE, f.size) : f.size;
+        size_t length = static_cast<size_t>(std::min<int64_t>(WRITE_BLOCK, limit - offset));
+        fill(buffer.data(), length, (offset < HEAD_SIZE) ? head : body);
+        for (size_t done = 0; done < length;) {
+            ssize_t n = write(fd, buffer.data() + done, length - done);
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            done += n;
+        }
+        offset += length;
+    }
+    if (!ok) error = f.path + ": " + strerror(errno);
+    return close(fd) == 0 && ok;
+}
+
+static bool is_empty_dir(const std::string &path, std::string &error) {
+    if (mkdir(path.c_str(), 0755) == 0) return true;
+    if (errno != EEXIST) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    bool empty = true;
+    while (struct dirent *d = readdir(dir)) {
+        if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) empty = false;
+    }
+    closedir(dir);
+    if (!empty) error = path + " is not empty";
+    return empty;
+}
+
+bool generate_tree(const std::string &root, const tree_shape &shape, tree_stats &stats, std::string &error) {
+    stats = tree_stats();
+    if (!is_empty_dir(root, error)) return false;
+    std::mt19937_64 rng(shape.seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double log_min = std::log(static_cast<double>(std::max<int64_t>(shape.min_size, 1)));
+    double log_max = std::log(static_cast<double>(std::max(shape.max_size, shape.min_size)));
+
+    /* directories hang under a random parent that is not yet at the deepest level */
+    std::vector<std::string> dirs(1, root);
+    std::vector<size_t> depth(1, 0), parents(1, 0);
+    size_t count = std::max<size_t>(1, shape.files / std::max<size_t>(shape.dir_size, 1));
+    while (dirs.size() < count && shape.depth > 0) {
+        size_t parent = parents[rng() % parents.size()];
+        std::string path = dirs[parent] + "/d" + std::to_string(dirs.size());
+        if (mkdir(path.c_str(), 0755) != 0) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        depth.push_back(depth[parent] + 1);
+        if (depth.back() < shape.depth) parents.push_back(dirs.size());
+        dirs.push_back(path);
+    }
+    stats.dirs = dirs.size();
+
+    std::vector<generated_file> written;
+    std::vector<char> buffer(WRITE_BLOCK);
+    for (size_t i = 0; i < shape.files; i++) {
+        generated_file f;
+        f.path = dirs[rng() % dirs.size()] + "/f" + std::to_string(i) + ".bin";
+        double r = uniform(rng);
+        const generated_file *earlier = (written.empty()) ? nullptr : &written[rng() % written.size()];
+        if (earlier != nullptr && r < shape.hardlinks) {
+            if (link(earlier->path.c_str(), f.path.c_str()) != 0) {
+                error = f.path + ": " + strerror(errno);
+                return false;
+            }
+            stats.hardlinks++;
+            stats.files++;
+            continue;
+        }
+        r -= shape.hardlinks;
+        if (earlier != nullptr && r < shape.duplicates) {
+            f.size = earlier->size;
+            f.head = earlier->head;
+            f.body = earlier->body;
+            stats.duplicates++;
+        } else if (earlier != nullptr && r - shape.duplicates < shape.same_size) {
+            f.size = earlier->size;
+            f.head = (uniform(rng) < shape.shared_head) ? earlier->head : rng();
+            f.body = rng();
+            stats.same_size++;
+        } else {
+            f.size = static_cast<int64_t>(std::exp(log_min + (log_max - log_min) * uniform(rng)));
+            f.head = rng();
+            f.body = rng();
+        }
+        if (!write_file(f, buffer, error)) return false;
+        stats.bytes += f.size;
+        stats.files++;
+        written.push_back(std::move(f));
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef TREEGEN_H
+#define TREEGEN_H
+
+#include <string>
+#include <cstdint>
+
+/* shape of a synthetic tree; the same shape and seed always give the same tree */
+struct tree_shape {
+    size_t files = 10000;
+    size_t depth = 4;               // deepest directory level below the root
+    size_t dir_size = 32;           // files per directory on average
+    int64_t min_size = 1024;        // sizes are log-uniform in [min_size, max_size]
+    int64_t max_size = 1024 * 1024;
+    double duplicates = 0.2;        // share of files that copy an earlier one
+    double same_size = 0.1;         // share of files with an earlier size but own content
+    double hardlinks = 0.05;        // share of files that are a hardlink to an earlier one
+    double shared_head = 0.5;       // share of same-size files that differ only after the first 4 KiB
+    uint64_t seed = 1;
+};
+
+struct tree_stats {
+    size_t files = 0, dirs = 0;
+    size_t duplicates = 0, same_size = 0, hardlinks = 0;
+    uint64_t bytes = 0;             // bytes written, hardlinks not counted
+};
+
+/* writes the tree under root, which must be empty or missing; false with error set on failure */
+bool generate_tree(const std::string &root, const tree_shape &shape, tree_stats &stats, std::string &error);
+
+#endif // TREEGEN_H
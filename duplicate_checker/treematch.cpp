@@ -0,0 +1,159 @@
+#include "treematch.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <cstring>
+
+const uint32_t NO_CLASS = UINT32_MAX;
+const char FILE_TAG = 'f', DIR_TAG = 'd';
+
+uint32_t tree_groups::top_of(const file_table &files, uint32_t dir) const {
+    if (copy_at(dir) == OUTSIDE) return dir;
+    while (files.parent_of(dir) != file_table::NO_DIR && copy_at(files.parent_of(dir)) != OUTSIDE) dir = files.parent_of(dir);
+    return dir;
+}
+
+void tree_groups::clear() {
+    trees.clear();
+    hash.clear();
+    files.clear();
+    bytes.clear();
+    collapsed.clear();
+    copy_of.clear();
+}
+
+/* ids of items by the directory they are in, as offsets into one array */
+static void by_dir(size_t dirs, size_t items, const std::function<uint32_t(size_t)> &dir_of,
+                   std::vector<uint32_t> &begin, std::vector<uint32_t> &list) {
+    begin.assign(dirs + 1, 0);
+    for (size_t i = 0; i < items; i++) {
+        if (dir_of(i) != file_table::NO_DIR) begin[dir_of(i) + 1]++;
+    }
+    for (size_t d = 0; d < dirs; d++) begin[d + 1] += begin[d];
+    std::vector<uint32_t> at(begin.begin(), begin.end() - 1);
+    list.resize(begin[dirs]);
+    for (size_t i = 0; i < items; i++) {
+        if (dir_of(i) != file_table::NO_DIR) list[at[dir_of(i)]++] = static_cast<uint32_t>(i);
+    }
+}
+
+void match_trees(const file_table &files, std::vector<std::vector<uint32_t>> &duplicates,
+                 const std::vector<std::vector<uint32_t>> &hardlinks, hash_algorithm algorithm, tree_groups &out) {
+    out.clear();
+    size_t dirs = files.dirs();
+    /* the group stands for the content, so collision mode splits are kept and nothing is read again */
+    std::vector<uint32_t> cls(files.files(), NO_CLASS);
+    for (size_t g = 0; g < duplicates.size(); g++) {
+        for (uint32_t f : duplicates[g]) cls[f] = static_cast<uint32_t>(g);
+    }
+    for (size_t g = 0; g < hardlinks.size(); g++) {
+        for (uint32_t f : hardlinks[g]) cls[f] = static_cast<uint32_t>(duplicates.size() + g);
+    }
+    std::vector<uint32_t> file_begin, file_list, sub_begin, sub_list;
+    by_dir(dirs, files.files(), [&files](size_t f) { return files.dir[f]; }, file_begin, file_list);
+    by_dir(dirs, dirs, [&files](size_t d) { return files.parent_of(static_cast<uint32_t>(d)); }, sub_begin, sub_list);
+
+    /* children are registered after their parents, so walking backwards digests them first */
+    std::vector<digest> hash(dirs);
+    std::vector<uint8_t> whole(dirs, 1);
+    std::vector<uint64_t> count(dirs, 0), bytes(dirs, 0);
+    std::unique_ptr<hasher> h = hasher::create(algorithm);
+    std::vector<std::pair<const char *, uint32_t>> entries;     // name and file id or directory id | top bit
+    const uint32_t IS_DIR = 1u << 31;
+    for (size_t d = dirs; d-- > 0;) {
+        entries.clear();
+        for (uint32_t k = file_begin[d]; k < file_begin[d + 1] && whole[d]; k++) {
+            uint32_t f = file_list[k];
+            if (cls[f] == NO_CLASS) whole[d] = 0;
+            count[d]++;
+            bytes[d] += files.size[f];
+            entries.push_back(std::make_pair(files.name_of(f), f));
+        }
+        for (uint32_t k = sub_begin[d]; k < sub_begin[d + 1] && whole[d]; k++) {
+            uint32_t s = sub_list[k];
+            if (!whole[s]) whole[d] = 0;
+            count[d] += count[s];
+            bytes[d] += bytes[s];
+            entries.push_back(std::make_pair(files.dir_name_of(s), s | IS_DIR));
+        }
+        if (!whole[d]) continue;
+        std::sort(entries.begin(), entries.end(), [](const std::pair<const char *, uint32_t> &a, const std::pair<const char *, uint32_t> &b) {
+            return strcmp(a.first, b.first) < 0;
+        });
+        for (auto &e : entries) {
+            bool sub = e.second & IS_DIR;
+            h->add(sub ? &DIR_TAG : &FILE_TAG, 1);
+            h->add(e.first, strlen(e.first) + 1);
+            if (sub) {
+                h->add(hash[e.second & ~IS_DIR]);
+            } else {
+                h->add(reinterpret_cast<const char *>(&cls[e.second]), sizeof(uint32_t));
+            }
+        }
+        hash[d] = h->result();
+    }
+
+    /* directories with files and a digest shared with another one */
+    std::vector<uint32_t> order;
+    for (uint32_t d = 0; d < dirs; d++) {
+        if (whole[d] && count[d] > 0) order.push_back(d);
+    }
+    std::sort(order.begin(), order.end(), [&hash](uint32_t a, uint32_t b) { return hash[a] < hash[b] || (hash[a] == hash[b] && a < b); });
+    std::vector<uint8_t> shared(dirs, 0);
+    for (size_t b = 0, e; b < order.size(); b = e) {
+        e = b + 1;
+        while (e < order.size() && hash[order[e]] == hash[order[b]]) e++;
+        for (size_t k = b; e - b > 1 && k < e; k++) shared[order[k]] = 1;
+    }
+    /* copies inside a copied parent are covered by the group of the parent */
+    for (size_t b = 0, e; b < order.size(); b = e) {
+        e = b + 1;
+        while (e < order.size() && hash[order[e]] == hash[order[b]]) e++;
+        std::vector<uint32_t> top;
+        for (size_t k = b; k < e; k++) {
+            uint32_t p = files.parent_of(order[k]);
+            if (p == file_table::NO_DIR || !shared[p]) top.push_back(order[k]);
+        }
+        if (top.size() < 2) continue;
+        std::vector<std::string> paths;
+        for (uint32_t d : top) paths.push_back(files.dir_path(d));
+        std::vector<size_t> by_path(top.size());
+        for (size_t k = 0; k < top.size(); k++) by_path[k] = k;
+        std::sort(by_path.begin(), by_path.end(), [&paths](size_t a, size_t b) { return paths[a] < paths[b]; });
+        std::vector<uint32_t> group;
+        for (size_t k : by_path) group.push_back(top[k]);
+        out.trees.push_back(std::move(group));
+    }
+    std::stable_sort(out.trees.begin(), out.trees.end(), [&bytes](const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+        return bytes[a[0]] > bytes[b[0]];
+    });
+    out.copy_of.assign(dirs, tree_groups::OUTSIDE);
+    for (auto &group : out.trees) {
+        out.hash.push_back(hash[group[0]]);
+        out.files.push_back(count[group[0]]);
+        out.bytes.push_back(bytes[group[0]]);
+        for (size_t k = 0; k < group.size(); k++) out.copy_of[group[k]] = (k == 0) ? tree_groups::KEPT : tree_groups::COPY;
+    }
+    for (uint32_t d = 0; d < dirs; d++) {
+        uint32_t p = files.parent_of(d);
+        if (out.copy_of[d] == tree_groups::OUTSIDE && p != file_table::NO_DIR) out.copy_of[d] = out.copy_of[p];
+    }
+
+    /* a group left with no file outside the trees is shown through them only */
+    auto inside = [&](const std::vector<uint32_t> &group) {
+        for (uint32_t f : group) {
+            if (out.copy_of[files.dir[f]] == tree_groups::OUTSIDE) return false;
+        }
+        return true;
+    };
+    /* the first file of a group is the one that stays, it is never one in a copy to be reclaimed;
+     * in a collapsed group that is a file of the kept copy */
+    for (auto &group : duplicates) {
+        out.collapsed.push_back(inside(group));
+        auto kept = std::find_if(group.begin(), group.end(), [&](uint32_t f) { return out.copy_of[files.dir[f]] != tree_groups::COPY; });
+        if (kept != group.end()) std::rotate(group.begin(), kept, kept + 1);
+    }
+    for (auto &group : hardlinks) out.collapsed.push_back(inside(group));
+}
@@ -0,0 +1,35 @@
+#ifndef TREEMATCH_H
+#define TREEMATCH_H
+
+#include "filetable.h"
+#include "hasher.h"
+
+#include <vector>
+#include <cstdint>
+
+/* directories whose whole subtrees are copies of each other, each group reported once at its top */
+struct tree_groups {
+    enum copy : uint8_t {OUTSIDE, KEPT, COPY};
+
+    std::vector<std::vector<uint32_t>> trees;   // directory ids, the first copy of a group is the kept one
+    std::vector<digest> hash;                   // per group, over the names and contents of a copy
+    std::vector<uint64_t> files, bytes;         // per group, in one copy
+    std::vector<uint8_t> collapsed;             // per duplicate group and then per hardlink set, all in the trees
+    std::vector<uint8_t> copy_of;               // per directory, the kind of copy it lies in
+
+    bool is_collapsed(size_t group) const { return group < collapsed.size() && collapsed[group]; }
+    copy copy_at(uint32_t dir) const { return (dir < copy_of.size()) ? static_cast<copy>(copy_of[dir]) : OUTSIDE; }
+    /* the top directory of the copy dir lies in, dir itself outside the trees */
+    uint32_t top_of(const file_table &files, uint32_t dir) const;
+    void clear();
+};
+
+/* digests every directory Merkle style from the sorted names of its entries, the group of each file
+ * and the digests of its subdirectories; a directory holding a file without a duplicate or a hardlink
+ * has none. Equal digests make a group, directories inside a group of their parents are left out.
+ * Every duplicate group gets a file outside the copies to reclaim first, the one that stays. Directories must be
+ * registered after their parents, as the walk does */
+void match_trees(const file_table &files, std::vector<std::vector<uint32_t>> &duplicates,
+                 const std::vector<std::vector<uint32_t>> &hardlinks, hash_algorithm algorithm, tree_groups &out);
+
+#endif // TREEMATCH_H
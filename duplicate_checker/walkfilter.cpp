@@ -0,0 +1,144 @@
+#include "walkfilter.h"
+
+#include <cstring>
+#include <sys/stat.h>
+
+bool pattern_set::compile(const std::string &pattern, glob &g) {
+    g.tokens.clear();
+    g.path = pattern.find('/') != std::string::npos;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        token t;
+        if (c == '*') {
+            bool deep = i + 1 < pattern.size() && pattern[i + 1] == '*';
+            if (deep) i++;
+            t.k = (deep) ? token::DEEP : token::STAR;
+            /* runs of stars are one star */
+            if (!g.tokens.empty() && (g.tokens.back().k == token::STAR || g.tokens.back().k == token::DEEP)) {
+                if (deep) g.tokens.back().k = token::DEEP;
+                continue;
+            }
+        } else if (c == '?') {
+            t.k = token::ONE;
+        } else if (c == '[') {
+            size_t j = i + 1;
+            bool negate = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+            if (negate) j++;
+            t.k = token::SET;
+            t.set.assign(256, false);
+            bool first = true;
+            for (; j < pattern.size() && (first || pattern[j] != ']'); j++, first = false) {
+                unsigned char from = pattern[j], to = from;
+                if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                    to = pattern[j + 2];
+                    j += 2;
+                }
+                for (unsigned v = from; v <= to; v++) t.set[v] = true;
+            }
+            if (j >= pattern.size()) return false;
+            if (negate) t.set.flip();
+            t.set['/'] = false;
+            i = j;
+        } else {
+            if (c == '\\') {
+                if (++i == pattern.size()) return false;
+                c = pattern[i];
+            }
+            if (!g.tokens.empty() && g.tokens.back().k == token::TEXT) {
+                g.tokens.back().text.push_back(c);
+                continue;
+            }
+            t.k = token::TEXT;
+            t.text.assign(1, c);
+        }
+        g.tokens.push_back(std::move(t));
+    }
+    return true;
+}
+
+bool pattern_set::match(const std::vector<token> &tokens, size_t t, const char *s) {
+    for (; t < tokens.size(); t++) {
+        const token &k = tokens[t];
+        switch (k.k) {
+            case token::TEXT:
+                if (strncmp(s, k.text.data(), k.text.size()) != 0) return false;
+                s += k.text.size();
+                break;
+            case token::ONE:
+                if (*s == '\0' || *s == '/') return false;
+                s++;
+                break;
+            case token::SET:
+                if (*s == '\0' || !k.set[static_cast<unsigned char>(*s)]) return false;
+                s++;
+                break;
+            default:
+                /* a star at the end takes the rest at once, otherwise every split is tried */
+                if (t + 1 == tokens.size()) return k.k == token::DEEP || strchr(s, '/') == nullptr;
+                for (;; s++) {
+                    if (match(tokens, t + 1, s)) return true;
+                    if (*s == '\0' || (*s == '/' && k.k == token::STAR)) return false;
+                }
+        }
+    }
+    return *s == '\0';
+}
+
+bool pattern_set::add_glob(const std::string &pattern) {
+    glob g;
+    if (pattern.empty() || !compile(pattern, g)) return false;
+    if (!g.path && g.tokens.size() == 1 && g.tokens[0].k == token::TEXT) {
+        names.insert(g.tokens[0].text);
+    } else if (!g.path && g.tokens.size() == 2 && g.tokens[0].k == token::STAR && g.tokens[1].k == token::TEXT) {
+        suffixes.push_back(g.tokens[1].text);
+    } else {
+        paths = paths || g.path;
+        globs.push_back(std::move(g));
+    }
+    return true;
+}
+
+bool pattern_set::add_regex(const std::string &pattern) {
+    try {
+        regexes.emplace_back(pattern, std::regex::ECMAScript | std::regex::optimize | std::regex::nosubs);
+    } catch (const std::regex_error &) {
+        return false;
+    }
+    paths = true;
+    return true;
+}
+
+bool pattern_set::match(const char *name, const std::string &path) const {
+    if (!names.empty() && names.count(name) > 0) return true;
+    size_t length = strlen(name);
+    for (auto &s : suffixes) {
+        if (length >= s.size() && memcmp(name + length - s.size(), s.data(), s.size()) == 0) return true;
+    }
+    for (auto &g : globs) {
+        if (match(g.tokens, 0, (g.path) ? path.c_str() : name)) return true;
+    }
+    for (auto &r : regexes) {
+        if (std::regex_search(path, r)) return true;
+    }
+    return false;
+}
+
+walk_filter::reason walk_filter::check_file(const char *name, const std::string &path, const struct stat &st) const {
+    if (st.st_size < min_size) return TOO_SMALL;
+    if (max_size >= 0 && st.st_size > max_size) return TOO_LARGE;
+    if (!exclude.empty() && exclude.match(name, path)) return EXCLUDED;
+    if (!include.empty() && !include.match(name, path)) return NOT_INCLUDED;
+    return NONE;
+}
+
+const char *walk_filter::name(reason r) {
+    switch (r) {
+        case HIDDEN: return "hidden";
+        case OTHER_DEVICE: return "on other file systems";
+        case EXCLUDED: return "excluded";
+        case NOT_INCLUDED: return "not included";
+        case TOO_SMALL: return "too small";
+        case TOO_LARGE: return "too large";
+        default: return "accepted";
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef WALKFILTER_H
+#define WALKFILTER_H
+
+#include <string>
+#include <vector>
+#include <regex>
+#include <unordered_set>
+#include <cstdint>
+
+struct stat;
+
+/* patterns compiled once when they are added: plain names are looked up in a hash set, "*.ext"
+ * ones by suffix, other globs are split into tokens for a backtracking matcher and regular
+ * expressions are built once; a glob with a slash and every regular expression are matched
+ * against the whole path, other globs against the name. In globs "*" and "?" stop at a slash,
+ * "**" does not, "[...]" takes a set of characters and "\" quotes the next one */
+class pattern_set {
+private:
+    struct token {
+        enum kind {TEXT, ONE, STAR, DEEP, SET} k;
+        std::string text;
+        std::vector<bool> set;        // by byte, for SET
+    };
+    struct glob {
+        std::vector<token> tokens;
+        bool path;
+    };
+
+    std::unordered_set<std::string> names;
+    std::vector<std::string> suffixes;
+    std::vector<glob> globs;
+    std::vector<std::regex> regexes;
+    bool paths;
+
+    static bool compile(const std::string &pattern, glob &g);
+    static bool match(const std::vector<token> &tokens, size_t t, const char *s);
+
+public:
+    pattern_set() : paths(false) {}
+
+    /* false if the pattern does not parse */
+    bool add_glob(const std::string &pattern);
+    bool add_regex(const std::string &pattern);
+    bool empty() const { return names.empty() && suffixes.empty() && globs.empty() && regexes.empty(); }
+    /* the path has to be given to match */
+    bool needs_path() const { return paths; }
+    bool match(const char *name, const std::string &path) const;
+};
+
+/* what the walk leaves out, decided from the directory entry and the stat it already has, so
+ * nothing rejected ever gets into the file table and a pruned directory is never opened */
+class walk_filter {
+public:
+    enum reason {NONE, HIDDEN, OTHER_DEVICE, EXCLUDED, NOT_INCLUDED, TOO_SMALL, TOO_LARGE, REASONS};
+
+    int64_t min_size = 0;
+    int64_t max_size = -1;            // -1 for no limit
+    bool hidden = false;              // hidden entries are listed too
+    bool one_device = false;          // mount points below a root are not entered
+    pattern_set exclude;              // files and directories
+    pattern_set include;              // files only, every file if empty
+
+    bool needs_path() const { return exclude.needs_path() || include.needs_path(); }
+    /* names of entries in a directory, "." and ".." are never listed */
+    reason check_name(const char *name) const {
+        return (name[0] == '.' && !hidden) ? HIDDEN : NONE;
+    }
+    reason check_dir(const char *name, const std::string &path) const {
+        return (!exclude.empty() && exclude.match(name, path)) ? EXCLUDED : NONE;
+    }
+    reason check_file(const char *name, const std::string &path, const struct stat &st) const;
+
+    static const char *name(reason r);
+};
+
+#endif // WALKFILTER_H
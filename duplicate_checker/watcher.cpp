@@ -0,0 +1,557 @@
+#include "watcher.h"
+#include "scantools.h"
+#include "dirwalker.h"
+
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+const uint32_t WATCH_EVENTS = IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                              | IN_ONLYDIR | IN_DONT_FOLLOW;
+const std::chrono::milliseconds QUIET(300);     // changes are collected until nothing happened for this long
+const std::chrono::milliseconds LATEST(2000);   // but a steady stream of them is not waited out longer
+const std::chrono::milliseconds POLL_PERIOD(10);
+const size_t EVENTS_BUFFER = 64 * 1024;
+const size_t READ_DEPTH = 64;
+
+const uint32_t dup_watcher::NONE;
+const uint32_t dup_watcher::GONE;
+const uint32_t dup_watcher::DIR_BIT;
+
+static int64_t mtime_of(const struct stat &st) {
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+dup_watcher::dup_watcher(hash_algorithm algorithm, read_engine::kind reader, const io_policy &policy, size_t threads)
+    : algorithm(algorithm), reader(reader), threads(threads), fd(-1), wake(-1), stopping(false),
+      live(0), used(0), reset(false), generation(0), watching(0) {
+    governor.set_policy(policy);
+}
+
+dup_watcher::~dup_watcher() {
+    stopping = true;
+    if (wake >= 0) {
+        uint64_t one = 1;
+        if (write(wake, &one, sizeof(one)) < 0) {}
+    }
+    if (thread.joinable()) thread.join();
+    if (fd >= 0) close(fd);
+    if (wake >= 0) close(wake);
+}
+
+bool dup_watcher::start(const scan_result &result, listener on_change, std::string &error) {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0 || wake < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    this->on_change = std::move(on_change);
+    /* the scanned table is taken over as it is, files and directories keep their ids; every file
+     * is in the working set again, a new one may share its size at any time */
+    table = result.files;
+    table.order.resize(table.files());
+    std::iota(table.order.begin(), table.order.end(), 0);
+    watch_of.assign(table.dirs(), -1);
+    for (uint32_t d = 0; d < table.dirs(); d++) {
+        if (table.parent_of(d) == file_table::NO_DIR) {
+            roots.push_back(table.dir_path(d));
+        } else {
+            index(d | DIR_BIT);
+        }
+        if (!watch(d) && errno == ENOSPC) {
+            error = "too many directories for the inotify watch limit (fs.inotify.max_user_watches)";
+            return false;
+        }
+    }
+    /* only digests of reported duplicates are known in full, the others are hashed when a file
+     * of the same size shows up; the groups of the scan stand until their size changes */
+    for (uint32_t f = 0; f < table.files(); f++) {
+        bool hashed = table.has(f, file_table::DUPLICATED);
+        table.flags[f] = (hashed) ? file_table::HASHED : 0;
+        if (!hashed) table.hash[f] = digest();
+        index(f);
+        sizes[table.size[f]].files.push_back(f);
+    }
+    for (auto &g : result.duplicates) sizes[table.size[g[0]]].duplicates.push_back(g);
+    for (auto &g : result.hardlinks) sizes[table.size[g[0]]].hardlinks.push_back(g);
+    latest = snapshot();
+    watching = dirs.size();
+    thread = std::thread(&dup_watcher::run, this);
+    return true;
+}
+
+std::shared_ptr<const scan_result> dup_watcher::current() const {
+    std::lock_guard<std::mutex> lg(lock);
+    return latest;
+}
+
+uint64_t dup_watcher::updates() const {
+    std::lock_guard<std::mutex> lg(lock);
+    return generation;
+}
+
+void dup_watcher::run() {
+    typedef std::chrono::steady_clock clock;
+    std::vector<char> buffer(EVENTS_BUFFER);
+    clock::time_point first, last;
+    bool waiting = false;
+    while (!stopping) {
+        int timeout = -1;
+        if (waiting) {
+            auto until = std::min(last + QUIET, first + LATEST);
+            timeout = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(until - clock::now()).count());
+        }
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {wake, POLLIN, 0}};
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) break;
+        if (stopping) break;
+        bool overflow = false, seen = false;
+        while (true) {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n <= 0) break;
+            for (ssize_t pos = 0; pos < n;) {
+                auto *event = reinterpret_cast<const struct inotify_event *>(buffer.data() + pos);
+                pos += sizeof(struct inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    overflow = true;
+                } else {
+                    handle(*event);
+                }
+                seen = true;
+            }
+        }
+        /* events were lost, the tree is walked again and digests of unchanged files are kept */
+        if (overflow) resync();
+        if (seen) {
+            last = clock::now();
+            if (!waiting) first = last;
+            waiting = !dirty.empty() || reset;
+        }
+        if (!waiting || clock::now() < std::min(last + QUIET, first + LATEST)) continue;
+        waiting = false;
+        bool changed = rehash();
+        if (stopping) break;
+        if (!changed) continue;
+        auto result = snapshot();
+        {
+            std::lock_guard<std::mutex> lg(lock);
+            latest = result;
+            generation++;
+        }
+        if (on_change) on_change(result);
+    }
+}
+
+size_t dup_watcher::slot_of(uint32_t parent, const char *name) const {
+    uint64_t h = 1469598103934665603ULL ^ parent;
+    for (; *name != '\0'; name++) h = (h ^ static_cast<uint8_t>(*name)) * 1099511628211ULL;
+    return static_cast<size_t>(h ^ (h >> 29)) & (slots.size() - 1);
+}
+
+void dup_watcher::key_of(uint32_t id, uint32_t &parent, const char *&name) const {
+    if (id & DIR_BIT) {
+        parent = table.parent_of(id & ~DIR_BIT);
+        name = table.dir_name_of(id & ~DIR_BIT);
+    } else {
+        parent = table.dir[id];
+        name = table.name_of(id);
+    }
+}
+
+uint32_t dup_watcher::find(uint32_t parent, const char *name, bool dir) const {
+    if (slots.empty()) return NONE;
+    for (size_t i = slot_of(parent, name);; i = (i + 1) & (slots.size() - 1)) {
+        uint32_t id = slots[i];
+        if (id == NONE) return NONE;
+        if (id == GONE || ((id & DIR_BIT) != 0) != dir) continue;
+        uint32_t p;
+        const char *n;
+        key_of(id, p, n);
+        if (p == parent && strcmp(n, name) == 0) return id & ~DIR_BIT;
+    }
+}
+
+void dup_watcher::index(uint32_t id) {
+    if ((used + 1) * 4 > slots.size() * 3) grow();
+    uint32_t parent;
+    const char *name;
+    key_of(id, parent, name);
+    size_t i = slot_of(parent, name);
+    while (slots[i] != NONE && slots[i] != GONE) i = (i + 1) & (slots.size() - 1);
+    used += slots[i] == NONE;
+    live++;
+    slots[i] = id;
+}
+
+void dup_watcher::unindex(uint32_t id) {
+    /* the entry is found by its key, so it goes before its row changes */
+    uint32_t parent;
+    const char *name;
+    key_of(id, parent, name);
+    for (size_t i = slot_of(parent, name); slots[i] != NONE; i = (i + 1) & (slots.size() - 1)) {
+        if (slots[i] != id) continue;
+        slots[i] = GONE;
+        live--;
+        return;
+    }
+}
+
+void dup_watcher::grow() {
+    /* removed slots are dropped on the way, the table only doubles when it is really full */
+    std::vector<uint32_t> old;
+    old.swap(slots);
+    size_t size = 64;
+    while (size * 3 < (live + 1) * 8) size *= 2;
+    slots.assign(size, NONE);
+    live = used = 0;
+    for (uint32_t id : old) {
+        if (id != NONE && id != GONE) index(id);
+    }
+}
+
+std::string dup_watcher::path_of(uint32_t dir, const char *name) const {
+    std::string path = table.dir_path(dir);
+    if (path.empty() || path.back() != '/') path.push_back('/');
+    path.append(name);
+    return path;
+}
+
+dup_watcher::entry dup_watcher::entry_of(uint32_t f) const {
+    return {table.size[f], table.mtime[f], table.dev[f], table.inode[f], table.nlink[f],
+            table.has(f, file_table::HASHED), table.hash[f]};
+}
+
+void dup_watcher::handle(const struct inotify_event &event) {
+    auto d = dirs.find(event.wd);
+    if (d == dirs.end()) return;
+    uint32_t parent = d->second;
+    if (event.mask & IN_IGNORED) {
+        if (watch_of[parent] == event.wd) watch_of[parent] = -1;
+        dirs.erase(d);
+        return;
+    }
+    /* entries the walk leaves out are left out here too */
+    if (event.len == 0 || filter.check_name(event.name) != walk_filter::NONE) return;
+    if (event.mask & IN_ISDIR) {
+        if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            uint32_t s = find(parent, event.name, true);
+            if (s != NONE) forget_tree(s);
+        }
+        if ((event.mask & (IN_CREATE | IN_MOVED_TO)) && filter.check_dir(event.name, path_of(parent, event.name)) == walk_filter::NONE) {
+            uint32_t s = find(parent, event.name, true);
+            if (s != NONE) forget_tree(s);
+            s = table.add_dir(parent, event.name, strlen(event.name));
+            index(s | DIR_BIT);
+            watch_tree(s);
+        }
+    } else if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+        uint32_t f = find(parent, event.name, false);
+        if (f != NONE) remove_file(f);
+    } else {
+        update_file(parent, event.name);
+    }
+}
+
+bool dup_watcher::watch(uint32_t dir) {
+    if (watch_of.size() < table.dirs()) watch_of.resize(table.dirs(), -1);
+    int wd = inotify_add_watch(fd, table.dir_path(dir).c_str(), WATCH_EVENTS);
+    if (wd < 0) return false;
+    /* the same directory under a new name keeps its descriptor */
+    auto d = dirs.find(wd);
+    if (d != dirs.end() && d->second != dir && watch_of[d->second] == wd) watch_of[d->second] = -1;
+    dirs[wd] = dir;
+    watch_of[dir] = wd;
+    return true;
+}
+
+void dup_watcher::watch_tree(uint32_t dir) {
+    /* the directory is watched before it is listed, so nothing created meanwhile is missed;
+     * the walk registers what it finds in the table itself */
+    watch(dir);
+    uint32_t first_dir = static_cast<uint32_t>(table.dirs()), first_file = static_cast<uint32_t>(table.files());
+    std::deque<dir_task> tasks;
+    tasks.push_back({dir, table.dir_path(dir)});
+    dir_walker walker(threads);
+    walker.set_filter(&filter);
+    walker.walk(tasks, table, [this]() { return stopping.load(); }, [](size_t, size_t) {});
+    for (uint32_t d = first_dir; d < table.dirs(); d++) {
+        index(d | DIR_BIT);
+        watch(d);
+    }
+    for (uint32_t f = first_file; f < table.files(); f++) {
+        uint32_t old = find(table.dir[f], table.name_of(f), false);
+        if (old != NONE) remove_file(old);
+        take_file(f);
+    }
+}
+
+void dup_watcher::forget_tree(uint32_t dir) {
+    /* directories come after their parents, so one pass finds everything below */
+    std::vector<uint8_t> below(table.dirs() - dir, 0);
+    below[0] = 1;
+    for (uint32_t d = dir + 1; d < table.dirs(); d++) {
+        uint32_t p = table.parent_of(d);
+        below[d - dir] = p != file_table::NO_DIR && p >= dir && below[p - dir];
+    }
+    for (uint32_t f = 0; f < table.files(); f++) {
+        uint32_t d = table.dir[f];
+        if (d != file_table::NO_DIR && d >= dir && below[d - dir]) remove_file(f);
+    }
+    /* a directory moved out of sight keeps its watches, they would report under the old paths */
+    for (uint32_t d = dir; d < table.dirs(); d++) {
+        if (!below[d - dir] || watch_of[d] == FORGOTTEN) continue;
+        unindex(d | DIR_BIT);
+        if (watch_of[d] >= 0) {
+            inotify_rm_watch(fd, watch_of[d]);
+            dirs.erase(watch_of[d]);
+        }
+        watch_of[d] = FORGOTTEN;
+    }
+}
+
+void dup_watcher::take_file(uint32_t f) {
+    auto d = departed.find(inode_key(table.dev[f], table.inode[f]));
+    if (!table.has(f, file_table::HASHED) && d != departed.end() && d->second.size == table.size[f] && d->second.mtime == table.mtime[f]) {
+        table.set(f, file_table::HASHED);
+        table.hash[f] = d->second.d;
+    }
+    index(f);
+    sizes[table.size[f]].files.push_back(f);
+    dirty.insert(table.size[f]);
+}
+
+void dup_watcher::add_file(uint32_t dir, const char *name, const entry &e) {
+    /* the name is interned again even in a reused row, the arena is compacted by a resync */
+    uint64_t at = table.intern(name, strlen(name));
+    uint32_t f;
+    if (free_rows.empty()) {
+        f = table.add_file(dir, at, e.size, e.mtime, e.dev, e.inode, e.nlink);
+    } else {
+        f = free_rows.back();
+        free_rows.pop_back();
+        table.dir[f] = dir;
+        table.name[f] = at;
+        table.size[f] = e.size;
+        table.mtime[f] = e.mtime;
+        table.dev[f] = e.dev;
+        table.inode[f] = e.inode;
+        table.nlink[f] = e.nlink;
+    }
+    table.hash[f] = e.d;
+    table.flags[f] = (e.hashed) ? file_table::HASHED : 0;
+    take_file(f);
+}
+
+void dup_watcher::remove_file(uint32_t f) {
+    auto b = sizes.find(table.size[f]);
+    if (b != sizes.end()) {
+        auto &files = b->second.files;
+        auto at = std::find(files.begin(), files.end(), f);
+        if (at != files.end()) {
+            *at = files.back();
+            files.pop_back();
+        }
+    }
+    dirty.insert(table.size[f]);
+    if (table.has(f, file_table::HASHED)) departed[inode_key(table.dev[f], table.inode[f])] = entry_of(f);
+    unindex(f);
+    table.dir[f] = file_table::NO_DIR;
+    free_rows.push_back(f);
+}
+
+bool dup_watcher::refresh(uint32_t dir, const char *name, entry &old) {
+    struct stat st;
+    uint32_t f = find(dir, name, false);
+    bool known = f != NONE;
+    if (known) old = entry_of(f);
+    std::string path = path_of(dir, name);
+    if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || filter.check_file(name, path, st) != walk_filter::NONE) {
+        if (known) remove_file(f);
+        return known;
+    }
+    entry e = {st.st_size, mtime_of(st), static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+               static_cast<uint32_t>(st.st_nlink), false, digest()};
+    if (known && old.size == e.size && old.mtime == e.mtime && old.dev == e.dev && old.inode == e.inode) {
+        /* only the link count moved, it changes what deleting frees but not the groups */
+        if (old.nlink == e.nlink) return false;
+        table.nlink[f] = e.nlink;
+        dirty.insert(e.size);
+        return false;
+    }
+    if (known) remove_file(f);
+    add_file(dir, name, e);
+    return known;
+}
+
+void dup_watcher::update_file(uint32_t dir, const char *name) {
+    entry old;
+    if (!refresh(dir, name, old) || old.nlink < 2) return;
+    /* a write through one link fires no event for the others, they are checked here;
+     * names are copied, the arena they are in grows while files are refreshed */
+    auto b = sizes.find(old.size);
+    if (b == sizes.end()) return;
+    std::vector<std::pair<uint32_t, std::string>> links;
+    for (uint32_t f : b->second.files) {
+        if (table.dev[f] == old.dev && table.inode[f] == old.inode) links.emplace_back(table.dir[f], table.name_of(f));
+    }
+    entry ignored;
+    for (auto &l : links) refresh(l.first, l.second.c_str(), ignored);
+}
+
+void dup_watcher::resync() {
+    for (uint32_t f = 0; f < table.files(); f++) {
+        if (table.dir[f] != file_table::NO_DIR && table.has(f, file_table::HASHED)) departed[inode_key(table.dev[f], table.inode[f])] = entry_of(f);
+    }
+    for (auto &w : dirs) inotify_rm_watch(fd, w.first);
+    dirs.clear();
+    watch_of.clear();
+    table.clear();
+    free_rows.clear();
+    slots.clear();
+    live = used = 0;
+    sizes.clear();
+    dirty.clear();
+    for (auto &root : roots) watch_tree(table.add_dir(file_table::NO_DIR, root.c_str(), root.size()));
+    reset = true;
+}
+
+bool dup_watcher::rehash() {
+    bool changed = reset;
+    reset = false;
+
+    /* first every inode of a changed size that needs a digest is read, one path each */
+    struct pending {
+        std::string path;
+        inode_key key;
+        bool ok;
+        digest d;
+    };
+    std::vector<pending> reads;
+    for (int64_t size : dirty) {
+        auto b = sizes.find(size);
+        if (b == sizes.end()) continue;
+        std::map<inode_key, uint32_t> unread;
+        std::set<inode_key> known;
+        for (uint32_t f : b->second.files) {
+            inode_key k(table.dev[f], table.inode[f]);
+            if (table.has(f, file_table::HASHED)) {
+                known.insert(k);
+            } else if (!unread.count(k)) {
+                unread[k] = f;
+            }
+        }
+        if (known.size() + unread.size() < 2) continue;
+        for (auto &u : unread) {
+            if (!known.count(u.first)) reads.push_back({table.path(u.second), u.first, false, digest()});
+        }
+    }
+    if (!reads.empty()) {
+        std::unique_ptr<read_engine> engine = read_engine::create(reader, threads, READ_DEPTH, governor, nullptr);
+        for (size_t i = 0; i < reads.size() && !stopping; i++) {
+            read_job job;
+            job.path = reads[i].path;
+            job.offset = 0;
+            job.length = -1;
+            job.hash = hasher::create(algorithm);
+            pending *r = &reads[i];
+            job.done = [r](bool ok, hasher &h) {
+                r->ok = ok;
+                if (ok) r->d = h.result();
+            };
+            while (!engine->push(std::move(job), POLL_PERIOD) && !stopping) {}
+        }
+        while (!engine->wait(POLL_PERIOD)) {
+            if (stopping) engine->discard();
+        }
+        if (stopping) return false;
+    }
+    std::map<inode_key, std::pair<bool, digest>> read_digests;
+    for (auto &r : reads) read_digests[r.key] = std::make_pair(r.ok, r.d);
+
+    /* then the groups of each changed size are built again from the digests of its inodes */
+    for (int64_t size : dirty) {
+        auto b = sizes.find(size);
+        if (b == sizes.end()) continue;
+        bucket &bk = b->second;
+        std::map<inode_key, std::vector<uint32_t>> units;
+        std::map<inode_key, const digest *> digests;
+        for (uint32_t f : bk.files) {
+            inode_key k(table.dev[f], table.inode[f]);
+            units[k].push_back(f);
+            auto r = read_digests.find(k);
+            if (r != read_digests.end() && r->second.first && !table.has(f, file_table::HASHED)) {
+                table.set(f, file_table::HASHED);
+                table.hash[f] = r->second.second;
+            }
+            if (table.has(f, file_table::HASHED)) digests[k] = &table.hash[f];
+        }
+        std::map<digest, std::vector<inode_key>> same;
+        std::vector<std::vector<uint32_t>> duplicates, hardlinks;
+        if (units.size() > 1) {
+            /* inodes that could not be read are left out like skipped files of a scan */
+            for (auto &d : digests) same[*d.second].push_back(d.first);
+        } else {
+            for (auto &u : units) same[digest()].push_back(u.first);
+        }
+        for (auto &s : same) {
+            std::vector<uint32_t> group;
+            for (auto &k : s.second) group.insert(group.end(), units[k].begin(), units[k].end());
+            std::sort(group.begin(), group.end(), [this](uint32_t f1, uint32_t f2) {
+                int c = strcmp(table.name_of(f1), table.name_of(f2));
+                return c < 0 || (c == 0 && (table.dir[f1] < table.dir[f2] || (table.dir[f1] == table.dir[f2] && f1 < f2)));
+            });
+            if (s.second.size() > 1) {
+                duplicates.push_back(std::move(group));
+            } else if (group.size() > 1) {
+                hardlinks.push_back(std::move(group));
+            }
+        }
+        /* rows are reused, so equal ids do not mean equal groups; and a link count change alone
+         * moves no group, but what deleting frees */
+        if (duplicates != bk.duplicates || hardlinks != bk.hardlinks || !duplicates.empty() || !hardlinks.empty()) changed = true;
+        bk.duplicates = std::move(duplicates);
+        bk.hardlinks = std::move(hardlinks);
+        if (bk.files.empty()) sizes.erase(b);
+    }
+    dirty.clear();
+    departed.clear();
+    return changed;
+}
+
+std::shared_ptr<const scan_result> dup_watcher::snapshot() const {
+    /* the views get only the grouped files, under the directory ids of the watched table */
+    auto res = std::make_shared<scan_result>();
+    file_table &t = res->files;
+    t = table.directories();
+    auto add = [this, &t](uint32_t f) {
+        const char *name = table.name_of(f);
+        uint32_t g = t.add_file(table.dir[f], t.intern(name, strlen(name)), table.size[f], table.mtime[f],
+                                table.dev[f], table.inode[f], table.nlink[f]);
+        t.hash[g] = table.hash[f];
+        return g;
+    };
+    for (auto &b : sizes) {
+        for (auto &g : b.second.duplicates) {
+            std::vector<uint32_t> group;
+            for (uint32_t f : g) {
+                group.push_back(add(f));
+                t.set(group.back(), file_table::DUPLICATED);
+            }
+            res->duplicates.push_back(std::move(group));
+        }
+        for (auto &g : b.second.hardlinks) {
+            std::vector<uint32_t> group;
+            for (uint32_t f : g) group.push_back(add(f));
+            res->hardlinks.push_back(std::move(group));
+        }
+    }
+    t.order.clear();
+    return res;
+}
@@ -0,0 +1,119 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include "hasher.h"
+#include "iopolicy.h"
+#include "readengine.h"
+#include "walkfilter.h"
+#include "filetable.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+struct scan_result;
+struct inotify_event;
+
+/* keeps the duplicates of a finished scan up to date: every directory is watched with inotify,
+ * created and modified files are hashed in full once their size is shared by another inode,
+ * and after each quiet spell a new result is published; files of a size of their own are
+ * never read, just like in a scan */
+class dup_watcher {
+public:
+    typedef std::function<void(std::shared_ptr<const scan_result>)> listener;
+
+private:
+    struct entry {
+        int64_t size, mtime;
+        uint64_t dev, inode;
+        uint32_t nlink;
+        bool hashed;
+        digest d;
+    };
+    typedef std::pair<uint64_t, uint64_t> inode_key;
+    struct bucket {
+        std::vector<uint32_t> files;
+        std::vector<std::vector<uint32_t>> duplicates, hardlinks;
+    };
+    static const uint32_t NONE = UINT32_MAX;
+    static const uint32_t GONE = UINT32_MAX - 1;     // a slot of a removed entry
+    static const uint32_t DIR_BIT = 0x80000000u;     // a slot holding a directory id
+    static const int FORGOTTEN = -2;                 // a directory removed or moved away, no longer indexed
+
+    hash_algorithm algorithm;
+    read_engine::kind reader;
+    size_t threads;
+    io_governor governor;
+    std::vector<std::string> roots;
+    walk_filter filter;
+    int fd;
+    int wake;
+    std::thread thread;
+    std::atomic<bool> stopping;
+    listener on_change;
+
+    /* touched by the watching thread only; files and directories are those of the scanned table,
+     * a removed file keeps its row with no directory until the row is taken by a new file */
+    file_table table;
+    std::vector<uint32_t> free_rows;
+    std::vector<uint32_t> slots;                     // open addressing by parent directory and name
+    size_t live, used;                               // slots holding an id, and those or GONE
+    std::unordered_map<int, uint32_t> dirs;          // by watch descriptor
+    std::vector<int> watch_of;                       // by directory id, -1 if not watched
+    std::map<int64_t, bucket> sizes;
+    std::set<int64_t> dirty;
+    std::map<inode_key, entry> departed;             // hashed files removed since the last rehash, moves keep their digest
+    bool reset;                                      // groups were rebuilt from scratch, publish anyway
+
+    mutable std::mutex lock;
+    std::shared_ptr<const scan_result> latest;
+    uint64_t generation;
+    size_t watching;
+
+    void run();
+    size_t slot_of(uint32_t parent, const char *name) const;
+    void key_of(uint32_t id, uint32_t &parent, const char *&name) const;
+    uint32_t find(uint32_t parent, const char *name, bool dir) const;
+    void index(uint32_t id);
+    void unindex(uint32_t id);
+    void grow();
+    std::string path_of(uint32_t dir, const char *name) const;
+    entry entry_of(uint32_t f) const;
+    bool watch(uint32_t dir);
+    void watch_tree(uint32_t dir);
+    void forget_tree(uint32_t dir);
+    void take_file(uint32_t f);
+    void add_file(uint32_t dir, const char *name, const entry &e);
+    void remove_file(uint32_t f);
+    bool refresh(uint32_t dir, const char *name, entry &old);
+    void update_file(uint32_t dir, const char *name);
+    void handle(const struct inotify_event &event);
+    void resync();
+    bool rehash();
+    std::shared_ptr<const scan_result> snapshot() const;
+
+public:
+    dup_watcher(hash_algorithm algorithm, read_engine::kind reader, const io_policy &policy, size_t threads);
+    ~dup_watcher();
+
+    /* entries the scan left out stay out, set before start */
+    void set_filter(const walk_filter &filter) { this->filter = filter; }
+    /* takes over the files of a finished scan and watches its directories from a thread of its own;
+     * on_change is called from that thread; false with a reason if inotify cannot be used */
+    bool start(const scan_result &result, listener on_change, std::string &error);
+    /* the duplicates as of the last published change */
+    std::shared_ptr<const scan_result> current() const;
+    uint64_t updates() const;
+    /* directories being watched when start returned */
+    size_t directories() const { return watching; }
+};
+
+#endif // WATCHER_H